@@ -1,6 +1,8 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <SDL.h>
 #include "display.h"
 #include "vector.h"
@@ -9,23 +11,39 @@
 #include "matrix.h"
 #include <math.h>
 #include "light.h"
+#include "material.h"
+#include "virtual_texture.h"
 #include "upng.h"
+#include "benchmark.h"
+#include "pipeline.h"
+#include "job.h"
+#include "context.h"
+#include "resolution.h"
+
+mesh_t mesh; // loaded once, then only read by the context
+render_context_t* context = NULL;
+framebuffer_layout_t framebuffer_layout = framebuffer_tiled;
+bool pipelined = false;
+quat_t spin; // rotation of the mesh from one frame to the next
+int num_lights = 0; // local lights to put around the mesh
+int shadow_cascades = 0; // shadow maps of the directional light, 0 for no shadows
+bool multisampling = false;
+float foveation_radius = 0; // pixels around the mouse shaded at the full rate, 0 for everywhere
+float frame_budget = 0; // milliseconds to draw a frame in by lowering the resolution, 0 for always full
+resolution_controller_t resolution;
 
-#define MAX_TRIANGLES_PER_MESH 10000
-triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
-int num_triangles_to_render = 0;
-
-vec3_t camera_position = { 0, 0, 0 };
-
-mat4_t proj_matrix;
 bool is_running = false;
 int previous_frame_time;
 
 void setup(void) {
-	rendering_mode = render_texture;
+	jobs_init();
 
-	color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
-	z_buffer = (float*)malloc(sizeof(float) * window_width * window_height);
+	context = context_create(window_width, window_height, framebuffer_layout, pipelined ? PIPELINE_DEPTH : 1);
+	if (context == NULL) {
+		fprintf(stderr, "Failed to create the render context!\n");
+		is_running = false;
+		return;
+	}
 
 	color_buffer_texture = SDL_CreateTexture(
 		renderer,
@@ -35,16 +53,37 @@ void setup(void) {
 		window_height
 	);
 
-	float fov = M_PI / 3.0; // equal to 60 degrees
-	float aspect = (float)window_height / (float)window_width;
-	float znear = 0.1;
-	float zfar = 100.0;
-	proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
+	mesh_init(&mesh);
+	spin = quat_from_euler((vec3_t){ 0.01, 0.01, 0.01 });
+	//load_cube_mesh_data(&mesh);
+	mesh.texture = load_png_texture_data("./assets/f22.png");
+	load_obj_file_data(&mesh, "./assets/f22.obj");
+	if (!context_set_mesh(context, &mesh)) {
+		fprintf(stderr, "Failed to set up the mesh!\n");
+		is_running = false;
+	}
+
+	if (shadow_cascades > 0 && !context_enable_shadows(context, shadow_cascades))
+		fprintf(stderr, "Failed to set up the shadow maps!\n");
 
-	//load_cube_mesh_data();
-	load_obj_file_data("./assets/f22.obj");
+	if (multisampling && !context_enable_multisampling(context))
+		fprintf(stderr, "Failed to set up multisampling!\n");
 
-	load_png_texture_data("./assets/f22.png");
+	if (foveation_radius > 0 && !context_enable_foveation(context, foveation_radius))
+		fprintf(stderr, "Failed to set up foveated shading!\n");
+
+	resolution_init(&resolution, frame_budget, 0.5);
+
+	// A ring of lights around where the mesh spins, every fourth one a spot aimed at it
+	vec3_t center = { 0, 0, 5 };
+	for (int i = 0; i < num_lights; i++) {
+		float angle = 2 * M_PI * i / num_lights;
+		vec3_t position = { 3 * cos(angle), 2 * sin(angle), 5 + sin(3 * angle) };
+		local_light_t light = i % 4 == 3 ?
+			light_make_spot(position, vec3_sub(center, position), 6.0, 1.0, 0.2, 0.35) :
+			light_make_point(position, 2.5, 0.6);
+		context_add_light(context, light);
+	}
 }
 
 void process_input(void) {
@@ -54,213 +93,151 @@ void process_input(void) {
 	case SDL_QUIT:
 		is_running = false;
 		break;
+	case SDL_MOUSEMOTION:
+		// Full rate shading follows the mouse
+		context->foveation_center = (vec2_t){ event.motion.x, event.motion.y };
+		break;
 	case SDL_KEYDOWN: {
 			if (event.key.keysym.sym == SDLK_ESCAPE)
 				is_running = false;
 
 			if (event.key.keysym.sym == SDLK_c)
-				backface_culling = true;
+				context->backface_culling = true;
 
 			if (event.key.keysym.sym == SDLK_d)
-				backface_culling = false;
+				context->backface_culling = false;
 			
 			// change rendering mode
 			if (event.key.keysym.sym == SDLK_1)
-				rendering_mode = wireframe | red_dot;
+				context->rendering_mode = wireframe | red_dot;
 			else if (event.key.keysym.sym == SDLK_2)
-				rendering_mode = wireframe;
+				context->rendering_mode = wireframe;
 			else if (event.key.keysym.sym == SDLK_3)
-				rendering_mode = filled_triangle;
+				context->rendering_mode = filled_triangle;
 			else if (event.key.keysym.sym == SDLK_4)
-				rendering_mode = filled_triangle | wireframe;
+				context->rendering_mode = filled_triangle | wireframe;
 			else if (event.key.keysym.sym == SDLK_5)
-				rendering_mode = render_texture;
+				context->rendering_mode = render_texture;
 			else if (event.key.keysym.sym == SDLK_6)
-				rendering_mode = render_texture | wireframe;
+				context->rendering_mode = render_texture | wireframe;
+
+			// change texture filtering
+			if (event.key.keysym.sym == SDLK_n)
+				context->texture_filter = filter_no_mip;
+			else if (event.key.keysym.sym == SDLK_m)
+				context->texture_filter = filter_nearest_mip;
+			else if (event.key.keysym.sym == SDLK_t)
+				context->texture_filter = filter_trilinear;
 		}
 	}
 }
 
-void update(void) {
-
+///////////////////////////////////////////////////////////////////////////////
+// Animate the mesh and make the triangles of the next frame in a slot
+///////////////////////////////////////////////////////////////////////////////
+void update(int slot) {
 	int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - previous_frame_time);
 	if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME)
 		SDL_Delay(time_to_wait);
 
 	previous_frame_time = SDL_GetTicks();
 
-	// initialize the counter of triangles to render for the current frame
-	num_triangles_to_render = 0;
-
-	mesh.rotation.x += 0.01;
-	mesh.rotation.y += 0.01;
-	mesh.rotation.z += 0.01;
-	mesh.translation.z = 5.0;
-
-	mat4_t scale_matrix = mat4_make_scale(mesh.scale.x, mesh.scale.y, mesh.scale.z);
-	mat4_t translation_matrix = mat4_make_translation(mesh.translation.x, mesh.translation.y, mesh.translation.z);
-	mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh.rotation.x);
-	mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh.rotation.y);
-	mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh.rotation.z);
+	// Spin by the same small rotation every frame, renormalizing so rounding doesn't build up
+	context->mesh.orientation = quat_mul(spin, context->mesh.orientation);
+	quat_normalize(&context->mesh.orientation);
+	context->mesh.translation.z = 5.0;
 
-	// Loop all triangle faces of our mesh
-	int num_faces = array_length(mesh.faces);
-	for (int i = 0; i < num_faces; i++) {
-		face_t mesh_face = mesh.faces[i];
+	// Scale the resolution by how long the last frame in this slot took, it is done drawing by now
+	if (frame_budget > 0)
+		context->resolution_scale = resolution_update(&resolution, context->streams[slot].work_time);
 
-		vec3_t face_vertices[3];
-		face_vertices[0] = mesh.vertices[mesh_face.a - 1];
-		face_vertices[1] = mesh.vertices[mesh_face.b - 1];
-		face_vertices[2] = mesh.vertices[mesh_face.c - 1];
-
-		vec4_t transformed_vertices[3];
-
-		// Loop all three vertices of this current face and apply transformations
-		for (int j = 0; j < 3; j++) {
-			vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-			// create a world matrix, combining scaling, rotation and translation
-			mat4_t world_matrix = mat4_identity();
-
-			// multiply all metrices and laod the world matrix
-			world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-			world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-			world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-
-			// multiply the world matrix by the original vector
-			transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-			
-			transformed_vertices[j] = transformed_vertex;
-		}
-
-		vec3_t vector_a = vec3_from_vec4(transformed_vertices[0]); /*    A    */
-		vec3_t vector_b = vec3_from_vec4(transformed_vertices[1]); /*   / \   */
-		vec3_t vector_c = vec3_from_vec4(transformed_vertices[2]); /*  B---C  */
-
-		vec3_t vector_ab = vec3_sub(vector_b, vector_a);
-		vec3_t vector_ac = vec3_sub(vector_c, vector_a);
-		vec3_normalize(&vector_ab);
-		vec3_normalize(&vector_ac);
-
-		vec3_t normal = vec3_cross(vector_ab, vector_ac);
-		vec3_normalize(&normal);
-
-		vec3_t camera_ray = vec3_sub(camera_position, vector_a);
-		vec3_normalize(&camera_ray);
-
-		float dot_normal_camera = vec3_dot(normal, camera_ray);
-
-		// check backface culling
-		if (backface_culling) {
-			if (dot_normal_camera < 0.0)
-				continue;
-		}
-
-		vec4_t projected_points[3];
-		for (int j = 0; j < 3; j++) {
-			// Project the current vertex
-			projected_points[j] = mat4_mul_vec4_project(proj_matrix, transformed_vertices[j]);
-
-			// scale
-			projected_points[j].x *= (window_width / 2.0);
-			projected_points[j].y *= (window_height / 2.0);
-
-			// invert y axis
-			projected_points[j].y *= -1;
-
-			// translate the projected points to the middle of the screen
-			projected_points[j].x += (window_width / 2.0);
-			projected_points[j].y += (window_height / 2.0);
-		}
-
-		float light_intensity_factor = vec3_dot(normal, light.direction) * -1;
-		uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
-
-		triangle_t projected_triangle = {
-			.points = {
-				{ projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
-				{ projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
-				{ projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w }
-			},
-			.texcoords = {
-				{ mesh_face.a_uv.u, mesh_face.a_uv.v },
-				{ mesh_face.b_uv.u, mesh_face.b_uv.v },
-				{ mesh_face.c_uv.u, mesh_face.c_uv.v }
-			},
-			.color = triangle_color
-		};
-
-		// Save the projected triangle in the array of triangles to render
-		if (num_triangles_to_render < MAX_TRIANGLES_PER_MESH) {
-			triangles_to_render[num_triangles_to_render] = projected_triangle;
-			num_triangles_to_render++;
-		}
-	}
+	context_update(context, slot);
 }
 
 void render(void) {
-	draw_grid();
-	
-	// Loop all projected triangles and render them
-	for (int i = 0; i < num_triangles_to_render; i++) {
-		triangle_t triangle = triangles_to_render[i];
+	framebuffer_t* target = context_framebuffer(context, 0);
+	begin_color_buffer(target);
+	context_draw(context, 0);
+	virtual_textures_end_frame();
+	render_color_buffer(target);
+	SDL_RenderPresent(renderer);
+}
 
-		if ((rendering_mode & red_dot) == red_dot) {
-			draw_rect(triangle.points[0].x - 3, triangle.points[0].y - 3, 6, 6, 0xFFFF0000);
-			draw_rect(triangle.points[1].x - 3, triangle.points[1].y - 3, 6, 6, 0xFFFF0000);
-			draw_rect(triangle.points[2].x - 3, triangle.points[2].y - 3, 6, 6, 0xFFFF0000);
-		}
-	   
-		if ((rendering_mode & filled_triangle) == filled_triangle) {
-			draw_filled_triangle(
-				triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w,
-				triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w,
-				triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w,
-				triangle.color
-			);
-		}
+// Pipeline stages, each one on its own thread
+static void geometry_stage(int slot) {
+	update(slot);
+}
 
-		if ((rendering_mode & render_texture) == render_texture) {
-			draw_textured_triangle(
-				triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v, // vertex A
-				triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v, // vertex B
-				triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v, // vertex C
-				mesh_texture
-			);
-		}
-		
-		if ((rendering_mode & wireframe) == wireframe) {
-			draw_triangle(
-				triangle.points[0].x, triangle.points[0].y, // vertex A
-				triangle.points[1].x, triangle.points[1].y, // vertex B
-				triangle.points[2].x, triangle.points[2].y, // vertex C
-				0xFFFFFFFF
-			);
-		}
-	}
+static void raster_stage(int slot) {
+	context_draw(context, slot);
+	// Only this thread draws, so the frame is done with the virtual textures here
+	virtual_textures_end_frame();
+}
 
-	render_color_buffer();
-	clear_color_buffer(0xFF000000);
-	clear_z_buffer();
-	SDL_RenderPresent(renderer);
+///////////////////////////////////////////////////////////////////////////////
+// Run the frames through the pipeline: while the main thread presents frame
+// N-1 and polls input, frame N is rasterized and frame N+1 transformed.
+///////////////////////////////////////////////////////////////////////////////
+void run_pipelined(void) {
+	if (!pipeline_start(geometry_stage, raster_stage)) {
+		fprintf(stderr, "Failed to start the frame pipeline!\n");
+		return;
+	}
+	while (is_running) {
+		process_input();
+		int slot = pipeline_acquire_frame();
+		present_framebuffer(context->framebuffers[slot]);
+		SDL_RenderPresent(renderer);
+		pipeline_release_frame();
+	}
+	pipeline_stop();
 }
 
 void free_resources(void) {
-	array_free(mesh.vertices);
-	array_free(mesh.faces);
-	free(color_buffer);
-	free(z_buffer);
-	upng_free(png_texture);
+	jobs_shutdown();
+	context_destroy(context);
+	free_mesh(&mesh);
+	free_materials();
+	free_textures();
 }
 
 int main(int argc, char* args[]) {
+	if (argc > 1 && strcmp(args[1], "--bench-png") == 0) {
+		benchmark_png_decode();
+		return 0;
+	}
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(args[i], "--compact-textures") == 0)
+			texture_compact = true;
+		else if (strcmp(args[i], "--virtual-textures") == 0)
+			virtual_texture_threshold = 0;
+		else if (strcmp(args[i], "--linear-framebuffer") == 0)
+			framebuffer_layout = framebuffer_linear;
+		else if (strcmp(args[i], "--pipelined") == 0)
+			pipelined = true;
+		else if (strcmp(args[i], "--threads") == 0 && i + 1 < argc)
+			job_threads = atoi(args[++i]);
+		else if (strcmp(args[i], "--lights") == 0 && i + 1 < argc)
+			num_lights = atoi(args[++i]);
+		else if (strcmp(args[i], "--shadows") == 0 && i + 1 < argc)
+			shadow_cascades = atoi(args[++i]);
+		else if (strcmp(args[i], "--msaa") == 0)
+			multisampling = true;
+		else if (strcmp(args[i], "--foveation") == 0 && i + 1 < argc)
+			foveation_radius = atof(args[++i]);
+		else if (strcmp(args[i], "--frame-budget") == 0 && i + 1 < argc)
+			frame_budget = atof(args[++i]);
+		else if (strcmp(args[i], "--upscale") == 0 && i + 1 < argc)
+			upscale_filter = strcmp(args[++i], "nearest") == 0 ? upscale_nearest : upscale_bilinear;
+	}
+
 	is_running = initialize_window();
 	setup();
+	if (pipelined)
+		run_pipelined();
 	while (is_running) {
 		process_input();
-		update();
+		update(0);
 		render();
 	}
 	destroy_window();
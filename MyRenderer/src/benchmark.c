@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <SDL.h>
+#include "benchmark.h"
+#include "upng.h"
+
+#define BENCHMARK_ITERATIONS 10
+
+static const char* benchmark_pngs[] = {
+	"./assets/crab.png",
+	"./assets/cube.png",
+	"./assets/drone.png",
+	"./assets/efa.png",
+	"./assets/f117.png",
+	"./assets/f22.png",
+	"./assets/pikuma.png"
+};
+
+typedef struct {
+	double seconds;       // average time of one decode
+	unsigned char* image; // decoded pixels of the first run, to compare the decoders
+	unsigned size;
+} decode_result_t;
+
+static decode_result_t time_png_decode(const unsigned char* bytes, unsigned long size, unsigned flags) {
+	decode_result_t result = { 0, NULL, 0 };
+	Uint64 start = SDL_GetPerformanceCounter();
+
+	for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+		upng_t* png = upng_new_from_bytes(bytes, size);
+		if (png == NULL)
+			return result;
+		upng_set_flags(png, flags);
+		if (upng_decode(png) == UPNG_EOK && result.image == NULL) {
+			result.size = upng_get_size(png);
+			result.image = (unsigned char*)malloc(result.size);
+			if (result.image != NULL)
+				memcpy(result.image, upng_get_buffer(png), result.size);
+		}
+		upng_free(png);
+	}
+
+	Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+	result.seconds = (double)elapsed / (double)SDL_GetPerformanceFrequency() / BENCHMARK_ITERATIONS;
+	return result;
+}
+
+static bool same_image(const decode_result_t* a, const decode_result_t* b) {
+	return a->size == b->size && memcmp(a->image, b->image, a->size) == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode every bundled png three ways and print the throughput of each in MB/s
+// of decoded pixels: the original buffered bit by bit decoder, the streaming
+// lookup table decoder with byte by byte unfiltering, and the same with the
+// SSE2/AVX2 unfiltering. Any output that differs from the first is flagged.
+///////////////////////////////////////////////////////////////////////////////
+void benchmark_png_decode(void) {
+	int num_pngs = sizeof(benchmark_pngs) / sizeof(benchmark_pngs[0]);
+
+	printf("%-20s %12s %12s %12s %8s\n", "png", "bitwise MB/s", "table MB/s", "simd MB/s", "speedup");
+	for (int i = 0; i < num_pngs; i++) {
+		FILE* file;
+		if (fopen_s(&file, benchmark_pngs[i], "rb") != 0 || file == NULL) {
+			printf("%-20s could not open the file\n", benchmark_pngs[i]);
+			continue;
+		}
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		rewind(file);
+		unsigned char* bytes = (unsigned char*)malloc(size);
+		if (bytes == NULL || fread(bytes, 1, size, file) != (size_t)size) {
+			printf("%-20s could not read the file\n", benchmark_pngs[i]);
+			free(bytes);
+			fclose(file);
+			continue;
+		}
+		fclose(file);
+
+		decode_result_t bitwise = time_png_decode(bytes, size, UPNG_FLAG_BITWISE_INFLATE | UPNG_FLAG_SCALAR_UNFILTER);
+		decode_result_t table = time_png_decode(bytes, size, UPNG_FLAG_SCALAR_UNFILTER);
+		decode_result_t simd = time_png_decode(bytes, size, UPNG_FLAG_NONE);
+
+		if (bitwise.image == NULL || table.image == NULL || simd.image == NULL) {
+			printf("%-20s failed to decode\n", benchmark_pngs[i]);
+		} else {
+			double megabytes = bitwise.size / (1024.0 * 1024.0);
+			bool identical = same_image(&bitwise, &table) && same_image(&bitwise, &simd);
+			printf("%-20s %12.1f %12.1f %12.1f %7.2fx%s\n",
+				benchmark_pngs[i],
+				megabytes / bitwise.seconds,
+				megabytes / table.seconds,
+				megabytes / simd.seconds,
+				bitwise.seconds / simd.seconds,
+				identical ? "" : "  MISMATCH"
+			);
+		}
+
+		free(bitwise.image);
+		free(table.image);
+		free(simd.image);
+		free(bytes);
+	}
+}
@@ -0,0 +1,149 @@
+#ifndef COLOR_H
+#define COLOR_H
+
+#include <stdint.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define COLOR_USE_SSE2
+#endif
+
+#define COLOR_ONE 256 // fixed point 1.0 of the factors and weights below
+
+////////////////////////////////////////////////////////////
+// Inline math on packed RGBA32 colors, the layout of the
+// textures and the frame: red in the low byte, then green,
+// blue and alpha in the top one. Each 8-bit channel is
+// widened to 16 bits, multiplied by an 8.8 fixed point
+// factor or weight and shifted back down, so the SSE2 paths
+// work on two colors per register and give exactly the same
+// results as the plain C ones.
+////////////////////////////////////////////////////////////
+
+// A float in [0, 1] as a factor in 0..COLOR_ONE, rounded to nearest
+static inline uint32_t color_factor(float factor) {
+	if (!(factor > 0)) return 0;
+	if (factor >= 1) return COLOR_ONE;
+	return (uint32_t)(factor * COLOR_ONE + 0.5f);
+}
+
+#ifdef COLOR_USE_SSE2
+// Two colors widened to eight 16-bit channels, a in the low half
+static inline __m128i color_unpack2(uint32_t a, uint32_t b) {
+	__m128i packed = _mm_unpacklo_epi32(_mm_cvtsi32_si128((int)a), _mm_cvtsi32_si128((int)b));
+	return _mm_unpacklo_epi8(packed, _mm_setzero_si128());
+}
+
+// (a * (COLOR_ONE - t) + b * t) >> 8 per channel, t already spread over the channels
+static inline __m128i color_lerp_channels(__m128i a, __m128i b, __m128i t) {
+	__m128i s = _mm_sub_epi16(_mm_set1_epi16(COLOR_ONE), t);
+	return _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(a, s), _mm_mullo_epi16(b, t)), 8);
+}
+#endif
+
+////////////////////////////////////////////////////////////
+// Modulate: scale the color channels by a factor in
+// 0..COLOR_ONE, alpha stays as it is
+////////////////////////////////////////////////////////////
+static inline uint32_t color_modulate(uint32_t color, uint32_t factor) {
+#ifdef COLOR_USE_SSE2
+	__m128i channels = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)color), _mm_setzero_si128());
+	__m128i factors = _mm_set_epi16(0, 0, 0, 0, COLOR_ONE, (short)factor, (short)factor, (short)factor);
+	channels = _mm_srli_epi16(_mm_mullo_epi16(channels, factors), 8);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(channels, channels));
+#else
+	uint32_t r = ((color & 0xFF) * factor) >> 8;
+	uint32_t g = (((color >> 8) & 0xFF) * factor) >> 8;
+	uint32_t b = (((color >> 16) & 0xFF) * factor) >> 8;
+	return (color & 0xFF000000) | (b << 16) | (g << 8) | r;
+#endif
+}
+
+// Four colors each by their own factor, out may be colors
+static inline void color_modulate4(uint32_t out[4], const uint32_t colors[4], const uint32_t factors[4]) {
+#ifdef COLOR_USE_SSE2
+	__m128i f01 = _mm_set_epi16(COLOR_ONE, (short)factors[1], (short)factors[1], (short)factors[1], COLOR_ONE, (short)factors[0], (short)factors[0], (short)factors[0]);
+	__m128i f23 = _mm_set_epi16(COLOR_ONE, (short)factors[3], (short)factors[3], (short)factors[3], COLOR_ONE, (short)factors[2], (short)factors[2], (short)factors[2]);
+	__m128i c01 = _mm_srli_epi16(_mm_mullo_epi16(color_unpack2(colors[0], colors[1]), f01), 8);
+	__m128i c23 = _mm_srli_epi16(_mm_mullo_epi16(color_unpack2(colors[2], colors[3]), f23), 8);
+	_mm_storeu_si128((__m128i*)out, _mm_packus_epi16(c01, c23));
+#else
+	for (int i = 0; i < 4; i++)
+		out[i] = color_modulate(colors[i], factors[i]);
+#endif
+}
+
+////////////////////////////////////////////////////////////
+// Blend: mix two colors channel by channel, alpha included,
+// t is the weight of b in 0..COLOR_ONE
+////////////////////////////////////////////////////////////
+static inline uint32_t color_lerp(uint32_t a, uint32_t b, uint32_t t) {
+#ifdef COLOR_USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i ca = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)a), zero);
+	__m128i cb = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)b), zero);
+	__m128i result = color_lerp_channels(ca, cb, _mm_set1_epi16((short)t));
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(result, result));
+#else
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t ca = (a >> shift) & 0xFF;
+		uint32_t cb = (b >> shift) & 0xFF;
+		result |= ((ca * (COLOR_ONE - t) + cb * t) >> 8) << shift;
+	}
+	return result;
+#endif
+}
+
+// Blend count colors of a with those of b by the same weight, out may be a or b
+static inline void color_lerp_row(uint32_t* out, const uint32_t* a, const uint32_t* b, int count, uint32_t t) {
+	int i = 0;
+#ifdef COLOR_USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i weight = _mm_set1_epi16((short)t);
+	for (; i + 4 <= count; i += 4) {
+		__m128i ca = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i cb = _mm_loadu_si128((const __m128i*)(b + i));
+		__m128i low = color_lerp_channels(_mm_unpacklo_epi8(ca, zero), _mm_unpacklo_epi8(cb, zero), weight);
+		__m128i high = color_lerp_channels(_mm_unpackhi_epi8(ca, zero), _mm_unpackhi_epi8(cb, zero), weight);
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(low, high));
+	}
+#endif
+	for (; i < count; i++)
+		out[i] = color_lerp(a[i], b[i], t);
+}
+
+// Blend four texels, c10 is right of c00 and c01 below it, both rows at once
+static inline uint32_t color_bilinear(uint32_t c00, uint32_t c10, uint32_t c01, uint32_t c11, uint32_t tx, uint32_t ty) {
+#ifdef COLOR_USE_SSE2
+	__m128i rows = color_lerp_channels(color_unpack2(c00, c01), color_unpack2(c10, c11), _mm_set1_epi16((short)tx));
+	__m128i result = color_lerp_channels(rows, _mm_unpackhi_epi64(rows, rows), _mm_set1_epi16((short)ty));
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(result, result));
+#else
+	return color_lerp(color_lerp(c00, c10, tx), color_lerp(c01, c11, tx), ty);
+#endif
+}
+
+////////////////////////////////////////////////////////////
+// Add: average of four colors, each channel separately,
+// rounding to nearest
+////////////////////////////////////////////////////////////
+static inline uint32_t color_average(uint32_t c00, uint32_t c01, uint32_t c10, uint32_t c11) {
+#ifdef COLOR_USE_SSE2
+	__m128i pairs = _mm_add_epi16(color_unpack2(c00, c01), color_unpack2(c10, c11));
+	__m128i sum = _mm_add_epi16(pairs, _mm_unpackhi_epi64(pairs, pairs));
+	sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+	return (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+#else
+	uint32_t result = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t sum =
+			((c00 >> shift) & 0xFF) + ((c01 >> shift) & 0xFF) +
+			((c10 >> shift) & 0xFF) + ((c11 >> shift) & 0xFF);
+		result |= ((sum + 2) / 4) << shift;
+	}
+	return result;
+#endif
+}
+
+#endif
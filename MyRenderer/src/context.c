@@ -0,0 +1,563 @@
+#include <stdlib.h>
+#include <math.h>
+#include "context.h"
+#include "display.h"
+#include "array.h"
+#include "job.h"
+#include "simd_math.h"
+
+#define FACES_PER_JOB 64 // faces a thread transforms at once
+#define VERTICES_PER_JOB 256
+#define ROWS_PER_BAND 32 // rows of the screen a thread rasterizes at once, a multiple of the framebuffer tile size
+#define BAND_MARGIN 4    // rows around a band a triangle may reach and still be drawn in it
+
+render_context_t* context_create(int width, int height, framebuffer_layout_t layout, int num_slots) {
+	render_context_t* context = (render_context_t*)calloc(1, sizeof(render_context_t));
+	if (context == NULL)
+		return NULL;
+
+	context->width = width;
+	context->height = height;
+	context->num_slots = num_slots;
+	context->streams = (triangle_stream_t*)calloc(num_slots, sizeof(triangle_stream_t));
+	context->framebuffers = (framebuffer_t**)calloc(num_slots, sizeof(framebuffer_t*));
+	context->background = (uint32_t*)malloc(sizeof(uint32_t) * width * height);
+	if (context->streams == NULL || context->framebuffers == NULL || context->background == NULL) {
+		context_destroy(context);
+		return NULL;
+	}
+	for (int i = 0; i < num_slots; i++) {
+		context->framebuffers[i] = framebuffer_create(width, height, layout);
+		if (context->framebuffers[i] == NULL || !light_grid_init(&context->streams[i].light_grid, width, height)) {
+			context_destroy(context);
+			return NULL;
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			context->background[(width * y) + x] = (y % 10 == 0 || x % 10 == 0) ? 0xFF222222 : 0xFF000000;
+		}
+	}
+
+	mesh_init(&context->mesh);
+	context->camera_position = (vec3_t){ 0, 0, 0 };
+	context->light.direction = (vec3_t){ 0, 0, 1 };
+
+	float fov = M_PI / 3.0; // equal to 60 degrees
+	float aspect = (float)height / (float)width;
+	float znear = 0.1;
+	float zfar = 100.0;
+	context->proj_matrix = mat4_make_perspective(fov, aspect, znear, zfar);
+
+	context->rendering_mode = render_texture;
+	context->backface_culling = true;
+	context->resolution_scale = 1;
+	context->texture_filter = filter_nearest_mip;
+	return context;
+}
+
+void context_destroy(render_context_t* context) {
+	if (context == NULL)
+		return;
+	if (context->framebuffers != NULL) {
+		for (int i = 0; i < context->num_slots; i++)
+			framebuffer_destroy(context->framebuffers[i]);
+	}
+	if (context->streams != NULL) {
+		for (int i = 0; i < context->num_slots; i++) {
+			light_grid_free(&context->streams[i].light_grid);
+			shadow_free(&context->streams[i].shadow);
+		}
+	}
+	free(context->framebuffers);
+	free(context->streams);
+	free(context->background);
+	free(context->world_vertices);
+	free(context->normal_intensities);
+	free(context->world_normals);
+	array_free(context->lights);
+	free(context);
+}
+
+// Draw a loaded mesh, starting from its transform
+bool context_set_mesh(render_context_t* context, const mesh_t* mesh) {
+	vec4_t* world_vertices = (vec4_t*)malloc(sizeof(vec4_t) * (array_length(mesh->vertices) + 1));
+	float* normal_intensities = (float*)malloc(sizeof(float) * (array_length(mesh->normals) + 1));
+	vec3_t* world_normals = (vec3_t*)malloc(sizeof(vec3_t) * (array_length(mesh->normals) + 1));
+	if (world_vertices == NULL || normal_intensities == NULL || world_normals == NULL) {
+		free(world_vertices);
+		free(normal_intensities);
+		free(world_normals);
+		return false;
+	}
+	free(context->world_vertices);
+	free(context->normal_intensities);
+	free(context->world_normals);
+	context->world_vertices = world_vertices;
+	context->normal_intensities = normal_intensities;
+	context->world_normals = world_normals;
+	context->mesh = *mesh;
+	return true;
+}
+
+// Light the mesh with one more point or spot light, up to MAX_LIGHTS
+bool context_add_light(render_context_t* context, local_light_t light) {
+	if (array_length(context->lights) >= MAX_LIGHTS)
+		return false;
+	array_push(context->lights, light);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cast shadows of the directional light, with num_cascades maps per slot
+// splitting the view depth, or one map for the whole mesh
+///////////////////////////////////////////////////////////////////////////////
+bool context_enable_shadows(render_context_t* context, int num_cascades) {
+	for (int i = 0; i < context->num_slots; i++) {
+		shadow_free(&context->streams[i].shadow);
+		if (!shadow_init(&context->streams[i].shadow, num_cascades)) {
+			for (int j = 0; j < i; j++)
+				shadow_free(&context->streams[j].shadow);
+			context->shadows = false;
+			return false;
+		}
+	}
+	context->shadows = true;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Anti-alias the edges of filled and textured triangles with 4x multisampling
+// in every slot's framebuffer
+///////////////////////////////////////////////////////////////////////////////
+bool context_enable_multisampling(render_context_t* context) {
+	for (int i = 0; i < context->num_slots; i++) {
+		if (!framebuffer_enable_multisampling(context->framebuffers[i]))
+			return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shade at full rate only within radius pixels of foveation_center, every
+// 2x2 block within twice that and every 4x4 block further out. The center
+// starts in the middle of the screen and can be moved at any time.
+///////////////////////////////////////////////////////////////////////////////
+bool context_enable_foveation(render_context_t* context, float radius) {
+	for (int i = 0; i < context->num_slots; i++) {
+		if (!framebuffer_enable_shading_rates(context->framebuffers[i]))
+			return false;
+	}
+	context->foveation_center = (vec2_t){ context->width / 2.0f, context->height / 2.0f };
+	context->foveation_radius = radius;
+	return true;
+}
+
+typedef struct {
+	render_context_t* context;
+	triangle_stream_t* stream;
+	mat3x4_t world_matrix;
+	mat3x4_t world_inverse; // its transpose takes object normals to world space
+	vec3_t object_camera;   // the camera position in object space
+	float facing;           // -1 when the world matrix mirrors the mesh and turns its faces inside out
+	bool cull;
+} transform_job_t;
+
+// Move the mesh vertices [begin, end) to world space
+static void transform_vertices(void* data, int begin, int end) {
+	transform_job_t* job = (transform_job_t*)data;
+	render_context_t* context = job->context;
+	mat3x4_transform_points(&job->world_matrix, &context->mesh.vertices[begin], &context->world_vertices[begin], end - begin);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light the mesh normals [begin, end), once each however many faces share
+// them. A normal goes to world space by the inverse transpose of the world
+// matrix, which keeps it square to the surface under any scale.
+///////////////////////////////////////////////////////////////////////////////
+static void light_normals(void* data, int begin, int end) {
+	transform_job_t* job = (transform_job_t*)data;
+	render_context_t* context = job->context;
+	const mat3x4_t* inverse = &job->world_inverse;
+
+	for (int i = begin; i < end; i++) {
+		const vec3_t* object_normal = &context->mesh.normals[i];
+		vec3_t normal = {
+			inverse->m[0][0] * object_normal->x + inverse->m[1][0] * object_normal->y + inverse->m[2][0] * object_normal->z,
+			inverse->m[0][1] * object_normal->x + inverse->m[1][1] * object_normal->y + inverse->m[2][1] * object_normal->z,
+			inverse->m[0][2] * object_normal->x + inverse->m[1][2] * object_normal->y + inverse->m[2][2] * object_normal->z
+		};
+		float length_squared = vec3_dot_ref(&normal, &normal);
+		float inverse_length = length_squared > 0 ? rsqrt_fast(length_squared) : 0;
+		context->normal_intensities[i] = -vec3_dot_ref(&normal, &context->light.direction) * inverse_length;
+		vec3_mul_ref(&context->world_normals[i], &normal, inverse_length);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Transform, cull and project the faces [begin, end). Face i is written to
+// triangle i of the stream, update packs the visible ones afterwards.
+///////////////////////////////////////////////////////////////////////////////
+static void transform_faces(void* data, int begin, int end) {
+	transform_job_t* job = (transform_job_t*)data;
+	const render_context_t* context = job->context;
+	triangle_stream_t* stream = job->stream;
+
+	for (int i = begin; i < end; i++) {
+		const face_t* mesh_face = &context->mesh.faces[i];
+
+		// check backface culling: the camera is behind the face's plane in object
+		// space exactly when it is in world space, so one dot product tells
+		if (job->cull) {
+			float camera_distance = vec3_dot_ref(&mesh_face->normal, &job->object_camera) - mesh_face->plane_offset;
+			if (camera_distance * job->facing < 0.0) {
+				stream->visible[i] = false;
+				continue;
+			}
+		}
+
+		// The vertices of this face, already in world space
+		vec4_t transformed_vertices[3];
+		transformed_vertices[0] = context->world_vertices[mesh_face->a - 1];
+		transformed_vertices[1] = context->world_vertices[mesh_face->b - 1];
+		transformed_vertices[2] = context->world_vertices[mesh_face->c - 1];
+
+		vec4_t projected_points[3];
+		for (int j = 0; j < 3; j++) {
+			// Project the current vertex
+			mat4_mul_vec4_project_ref(&projected_points[j], &context->proj_matrix, &transformed_vertices[j]);
+
+			// scale
+			projected_points[j].x *= (stream->width / 2.0);
+			projected_points[j].y *= (stream->height / 2.0);
+
+			// invert y axis
+			projected_points[j].y *= -1;
+
+			// translate the projected points to the middle of the screen
+			projected_points[j].x += (stream->width / 2.0);
+			projected_points[j].y += (stream->height / 2.0);
+		}
+
+		triangle_t projected_triangle = {
+			.points = {
+				{ projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
+				{ projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
+				{ projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w }
+			},
+			.texcoords = {
+				{ mesh_face->a_uv.u, mesh_face->a_uv.v },
+				{ mesh_face->b_uv.u, mesh_face->b_uv.v },
+				{ mesh_face->c_uv.u, mesh_face->c_uv.v }
+			},
+			.intensities = {
+				context->normal_intensities[mesh_face->a_normal - 1],
+				context->normal_intensities[mesh_face->b_normal - 1],
+				context->normal_intensities[mesh_face->c_normal - 1]
+			},
+			.color = mesh_face->color,
+			.surface = {
+				.points = {
+					{ transformed_vertices[0].x, transformed_vertices[0].y, transformed_vertices[0].z },
+					{ transformed_vertices[1].x, transformed_vertices[1].y, transformed_vertices[1].z },
+					{ transformed_vertices[2].x, transformed_vertices[2].y, transformed_vertices[2].z }
+				},
+				.normals = {
+					context->world_normals[mesh_face->a_normal - 1],
+					context->world_normals[mesh_face->b_normal - 1],
+					context->world_normals[mesh_face->c_normal - 1]
+				}
+			},
+			.texture = mesh_face->texture != TEXTURE_NONE ? mesh_face->texture : context->mesh.texture
+		};
+
+		stream->triangles[i] = projected_triangle;
+		stream->visible[i] = true;
+	}
+}
+
+// Milliseconds since a performance counter reading
+static float elapsed_ms(Uint64 start) {
+	return (float)((double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+}
+
+// A side of the context scaled down, never under a tile
+static int scaled_size(int size, float scale) {
+	int scaled = (int)(size * scale + 0.5f);
+	if (scaled > size)
+		return size;
+	return scaled < FRAMEBUFFER_TILE_SIZE ? FRAMEBUFFER_TILE_SIZE : scaled;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Make the triangle stream of a slot from the mesh and its current transform,
+// projected for the size resolution_scale gives the frame
+///////////////////////////////////////////////////////////////////////////////
+void context_update(render_context_t* context, int slot) {
+	Uint64 start = SDL_GetPerformanceCounter();
+	triangle_stream_t* stream = &context->streams[slot];
+	const mesh_t* mesh = &context->mesh;
+
+	// initialize the counter of triangles to render for the current frame
+	stream->num_triangles = 0;
+	stream->rendering_mode = context->rendering_mode;
+	stream->texture_filter = context->texture_filter;
+	stream->shadows = context->shadows;
+
+	// The light grid has tiles enough for the full size, so any smaller one fits
+	stream->width = scaled_size(context->width, context->resolution_scale);
+	stream->height = scaled_size(context->height, context->resolution_scale);
+	light_grid_resize(&stream->light_grid, stream->width, stream->height);
+	stream->foveation_center = (vec2_t){
+		context->foveation_center.x * stream->width / context->width,
+		context->foveation_center.y * stream->height / context->height
+	};
+
+	// The world matrix is affine: scale, rotate by the orientation, then translate.
+	// Only the projection needs the full 4x4 matrix.
+	mat3x4_t world_matrix = mat3x4_make_world(mesh->scale, mesh->orientation, mesh->translation);
+
+	transform_job_t job = { context, stream, world_matrix };
+
+	// Cull in object space, with the camera taken there once for the whole mesh.
+	// A flattened mesh has no inverse, but then it has no back faces either.
+	float determinant = mat3x4_determinant(world_matrix);
+	job.cull = context->backface_culling && determinant != 0;
+	job.facing = determinant < 0 ? -1.0f : 1.0f;
+	job.world_inverse = determinant != 0 ? mat3x4_inverse(world_matrix) : mat3x4_identity();
+	mat3x4_mul_vec3_ref(&job.object_camera, &job.world_inverse, &context->camera_position);
+
+	// Move every vertex to world space once, faces sharing it then just look it up
+	parallel_for(transform_vertices, &job, array_length(mesh->vertices), VERTICES_PER_JOB);
+	parallel_for(light_normals, &job, array_length(mesh->normals), VERTICES_PER_JOB);
+
+	// Draw the shadow maps again if the light or the mesh moved since this slot last drew them
+	if (context->shadows) {
+		shadow_scene_t scene = {
+			mesh->faces, array_length(mesh->faces),
+			context->world_vertices, array_length(mesh->vertices),
+			world_matrix, context->light.direction, context->camera_position, &context->proj_matrix
+		};
+		shadow_update(&stream->shadow, &scene);
+	}
+
+	// Transform the faces on every thread, then keep the visible triangles in face order
+	int num_faces = array_length(mesh->faces);
+	if (num_faces > MAX_TRIANGLES_PER_MESH)
+		num_faces = MAX_TRIANGLES_PER_MESH;
+	parallel_for(transform_faces, &job, num_faces, FACES_PER_JOB);
+
+	for (int i = 0; i < num_faces; i++) {
+		if (stream->visible[i])
+			stream->triangles[stream->num_triangles++] = stream->triangles[i];
+	}
+
+	// Bin the local lights to the screen tiles they reach, so pixels only go through the lights near them
+	light_grid_build(&stream->light_grid, context->lights, array_length(context->lights), &context->proj_matrix, context->camera_position);
+
+	stream->work_time = elapsed_ms(start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Order the triangles to render by texture with a counting sort, so all the
+// triangles of one texture are drawn back to back while its texels are still
+// in the cache. Triangles keep their relative order within a texture.
+///////////////////////////////////////////////////////////////////////////////
+static void sort_triangles_by_texture(triangle_stream_t* stream) {
+	int bucket_start[MAX_TEXTURES + 1] = { 0 }; // bucket 0 holds the untextured triangles
+
+	for (int i = 0; i < stream->num_triangles; i++)
+		bucket_start[stream->triangles[i].texture + 1]++;
+
+	int start = 0;
+	for (int bucket = 0; bucket <= MAX_TEXTURES; bucket++) {
+		int count = bucket_start[bucket];
+		bucket_start[bucket] = start;
+		start += count;
+	}
+
+	for (int i = 0; i < stream->num_triangles; i++)
+		stream->order[bucket_start[stream->triangles[i].texture + 1]++] = i;
+}
+
+// Drawing reads only the stream, so input can change the context while a frame is drawn
+typedef struct {
+	const triangle_stream_t* stream;
+	framebuffer_t* target;
+} draw_job_t;
+
+// Draw a triangle in its shaded color, multisampled when the target is
+static void draw_shaded(framebuffer_t* target, const triangle_t* triangle, const pixel_lighting_t* lighting) {
+	const vec4_t* points = triangle->points;
+	if (target->edge != NULL) {
+		draw_filled_triangle_multisampled(
+			target,
+			points[0].x, points[0].y, points[0].z, points[0].w, triangle->intensities[0],
+			points[1].x, points[1].y, points[1].z, points[1].w, triangle->intensities[1],
+			points[2].x, points[2].y, points[2].z, points[2].w, triangle->intensities[2],
+			triangle->color, &triangle->surface, lighting
+		);
+		return;
+	}
+	draw_filled_triangle(
+		target,
+		points[0].x, points[0].y, points[0].z, points[0].w, triangle->intensities[0],
+		points[1].x, points[1].y, points[1].z, points[1].w, triangle->intensities[1],
+		points[2].x, points[2].y, points[2].z, points[2].w, triangle->intensities[2],
+		triangle->color, &triangle->surface, lighting
+	);
+}
+
+// Draw a triangle mapped with a texture, multisampled when the target is
+static void draw_textured(framebuffer_t* target, const triangle_t* triangle, texture_t* texture, texture_filter_t filter) {
+	const vec4_t* points = triangle->points;
+	const tex2_t* texcoords = triangle->texcoords;
+	if (target->edge != NULL) {
+		draw_textured_triangle_multisampled(
+			target,
+			points[0].x, points[0].y, points[0].z, points[0].w, texcoords[0].u, texcoords[0].v, // vertex A
+			points[1].x, points[1].y, points[1].z, points[1].w, texcoords[1].u, texcoords[1].v, // vertex B
+			points[2].x, points[2].y, points[2].z, points[2].w, texcoords[2].u, texcoords[2].v, // vertex C
+			texture, filter
+		);
+		return;
+	}
+	draw_textured_triangle(
+		target,
+		points[0].x, points[0].y, points[0].z, points[0].w, texcoords[0].u, texcoords[0].v, // vertex A
+		points[1].x, points[1].y, points[1].z, points[1].w, texcoords[1].u, texcoords[1].v, // vertex B
+		points[2].x, points[2].y, points[2].z, points[2].w, texcoords[2].u, texcoords[2].v, // vertex C
+		texture, filter
+	);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Whether a triangle can touch the rows of a band. A few rows of margin
+// cover the red dots drawn around its vertices and the rounding of the
+// rasterizers, so no triangle that draws in the band is ever left out.
+///////////////////////////////////////////////////////////////////////////////
+static bool triangle_in_band(const triangle_t* triangle, const framebuffer_t* band) {
+	float min_y = triangle->points[0].y;
+	float max_y = triangle->points[0].y;
+	for (int j = 1; j < 3; j++) {
+		if (triangle->points[j].y < min_y)
+			min_y = triangle->points[j].y;
+		if (triangle->points[j].y > max_y)
+			max_y = triangle->points[j].y;
+	}
+	return !(max_y + BAND_MARGIN < band->clip_top || min_y - BAND_MARGIN >= band->clip_bottom);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the triangles of a stream into the bands of rows [begin, end). Every
+// band goes through all the triangles in order, skipping those outside it
+// before any setup, so no two threads ever draw the same pixel and each pixel
+// sees the triangles in the same order as when drawing the whole screen at
+// once. A multisampled band is resolved by the thread that drew it as soon as
+// it is done.
+///////////////////////////////////////////////////////////////////////////////
+static void draw_bands(void* data, int begin, int end) {
+	draw_job_t* job = (draw_job_t*)data;
+	const triangle_stream_t* stream = job->stream;
+	pixel_lighting_t lighting = { &stream->light_grid, stream->shadows ? &stream->shadow : NULL };
+
+	for (int band_index = begin; band_index < end; band_index++) {
+		framebuffer_t band = framebuffer_rows(job->target, band_index * ROWS_PER_BAND, (band_index + 1) * ROWS_PER_BAND);
+
+		// Loop all projected triangles and render them
+		for (int i = 0; i < stream->num_triangles; i++) {
+			const triangle_t* triangle = &stream->triangles[stream->order[i]];
+			if (!triangle_in_band(triangle, &band))
+				continue;
+
+			if ((stream->rendering_mode & red_dot) == red_dot) {
+				draw_rect(&band, triangle->points[0].x - 3, triangle->points[0].y - 3, 6, 6, 0xFFFF0000);
+				draw_rect(&band, triangle->points[1].x - 3, triangle->points[1].y - 3, 6, 6, 0xFFFF0000);
+				draw_rect(&band, triangle->points[2].x - 3, triangle->points[2].y - 3, 6, 6, 0xFFFF0000);
+			}
+
+			if ((stream->rendering_mode & filled_triangle) == filled_triangle) {
+				draw_shaded(&band, triangle, &lighting);
+			}
+
+			texture_t* texture = get_texture(triangle->texture);
+			if ((stream->rendering_mode & render_texture) == render_texture && texture == NULL) {
+				// No texture to map, fall back to the shaded color
+				draw_shaded(&band, triangle, &lighting);
+			} else if ((stream->rendering_mode & render_texture) == render_texture) {
+				draw_textured(&band, triangle, texture, stream->texture_filter);
+			}
+
+			if ((stream->rendering_mode & wireframe) == wireframe) {
+				draw_triangle(
+					&band,
+					triangle->points[0].x, triangle->points[0].y, // vertex A
+					triangle->points[1].x, triangle->points[1].y, // vertex B
+					triangle->points[2].x, triangle->points[2].y, // vertex C
+					0xFFFFFFFF
+				);
+			}
+		}
+
+		framebuffer_resolve(&band);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Fit a stream made for one size to a framebuffer of another. Screen
+// positions go linearly with the size, so scaling them is the same as
+// projecting again, while the lights have to be binned to the tiles again.
+///////////////////////////////////////////////////////////////////////////////
+static void fit_stream(const render_context_t* context, triangle_stream_t* stream, int width, int height) {
+	float scale_x = (float)width / stream->width;
+	float scale_y = (float)height / stream->height;
+	for (int i = 0; i < stream->num_triangles; i++) {
+		for (int j = 0; j < 3; j++) {
+			stream->triangles[i].points[j].x *= scale_x;
+			stream->triangles[i].points[j].y *= scale_y;
+		}
+	}
+	stream->foveation_center.x *= scale_x;
+	stream->foveation_center.y *= scale_y;
+	stream->width = width;
+	stream->height = height;
+	light_grid_resize(&stream->light_grid, width, height);
+	light_grid_build(&stream->light_grid, context->lights, array_length(context->lights), &context->proj_matrix, context->camera_position);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The framebuffer of a slot, resized to the frame last updated in it. Only
+// call it where the framebuffer may be written, it can't be resized while
+// presented or with its color bound, and then the frame is fitted to the
+// size it has instead.
+///////////////////////////////////////////////////////////////////////////////
+framebuffer_t* context_framebuffer(render_context_t* context, int slot) {
+	triangle_stream_t* stream = &context->streams[slot];
+	framebuffer_t* framebuffer = context->framebuffers[slot];
+	if (stream->width > 0 && !framebuffer_resize(framebuffer, stream->width, stream->height))
+		fit_stream(context, stream, framebuffer->width, framebuffer->height);
+	return framebuffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the triangle stream of a slot into its framebuffer. Pages of virtual
+// textures it finds missing are only recorded, the application installs them
+// with virtual_textures_end_frame between frames.
+///////////////////////////////////////////////////////////////////////////////
+void context_draw(render_context_t* context, int slot) {
+	Uint64 start = SDL_GetPerformanceCounter();
+	triangle_stream_t* stream = &context->streams[slot];
+	framebuffer_t* target = context_framebuffer(context, slot);
+
+	framebuffer_clear(target, context->background, context->width);
+	framebuffer_foveate(target, stream->foveation_center.x, stream->foveation_center.y, context->foveation_radius);
+
+	sort_triangles_by_texture(stream);
+
+	draw_job_t job = { stream, target };
+	int num_bands = (target->height + ROWS_PER_BAND - 1) / ROWS_PER_BAND;
+	parallel_for(draw_bands, &job, num_bands, 1);
+
+	stream->work_time += elapsed_ms(start);
+}
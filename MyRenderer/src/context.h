@@ -0,0 +1,85 @@
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "framebuffer.h"
+#include "triangle.h"
+#include "texture.h"
+#include "matrix.h"
+#include "mesh.h"
+#include "light.h"
+#include "shadow.h"
+
+#define MAX_TRIANGLES_PER_MESH 10000
+
+// Bits of rendering_mode
+enum {
+	wireframe = 0x1,
+	red_dot = 0x2,
+	filled_triangle = 0x4,
+	render_texture = 0x8
+};
+
+// The triangles one frame draws, made by context_update and consumed by context_draw
+typedef struct {
+	triangle_t triangles[MAX_TRIANGLES_PER_MESH];
+	int num_triangles;
+	int order[MAX_TRIANGLES_PER_MESH]; // indices into triangles grouped by texture
+	uint8_t rendering_mode;            // mode when the frame was made, input may change it meanwhile
+	texture_filter_t texture_filter;   // filter when the frame was made
+	bool shadows;                      // whether the frame samples the shadow maps
+	bool visible[MAX_TRIANGLES_PER_MESH]; // faces update kept after culling
+	light_grid_t light_grid;              // the local lights when the frame was made, binned to screen tiles
+	shadow_t shadow;                      // shadow maps of the frame, kept while nothing they show moves
+	vec2_t foveation_center;              // where the eye was when the frame was made
+	int width;                            // size the frame is drawn at, the context's scaled by resolution_scale
+	int height;
+	float work_time;                      // milliseconds spent updating and drawing the frame
+} triangle_stream_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Everything one render changes, so any number of contexts can render on
+// their own threads at once. They only share what was loaded before they
+// started: the mesh arrays, the texture registry and the materials. Virtual
+// texture caches only change in virtual_textures_end_frame, which the
+// application calls while none of them is drawing.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	int width;
+	int height;
+	int num_slots;                  // frames in flight, each with its own stream and framebuffer
+	triangle_stream_t* streams;
+	framebuffer_t** framebuffers;
+	uint32_t* background;           // black with a grid line every 10 pixels, copied in by every clear
+
+	mesh_t mesh;                    // shares the arrays of the loaded mesh, the transform is the context's own
+	vec4_t* world_vertices;         // the mesh vertices moved to world space by the last update
+	float* normal_intensities;      // light on each of the mesh normals at the last update
+	vec3_t* world_normals;          // the mesh normals in world space at the last update, unit length
+	vec3_t camera_position;
+	mat4_t proj_matrix;
+	light_t light;
+	local_light_t* lights;          // dynamic array of point and spot lights in world space
+
+	uint8_t rendering_mode;
+	bool backface_culling;
+	bool shadows;                   // whether context_enable_shadows set up the slots' shadow maps
+	texture_filter_t texture_filter;
+	vec2_t foveation_center;        // screen point shaded at the full rate, when foveated
+	float foveation_radius;         // 0 to shade every pixel everywhere
+	float resolution_scale;         // fraction of width and height frames are drawn at, up to 1
+} render_context_t;
+
+render_context_t* context_create(int width, int height, framebuffer_layout_t layout, int num_slots);
+void context_destroy(render_context_t* context);
+bool context_set_mesh(render_context_t* context, const mesh_t* mesh);
+bool context_add_light(render_context_t* context, local_light_t light);
+bool context_enable_shadows(render_context_t* context, int num_cascades);
+bool context_enable_multisampling(render_context_t* context);
+bool context_enable_foveation(render_context_t* context, float radius);
+void context_update(render_context_t* context, int slot);
+framebuffer_t* context_framebuffer(render_context_t* context, int slot);
+void context_draw(render_context_t* context, int slot);
+
+#endif
@@ -1,19 +1,19 @@
+#include <stdlib.h>
+#include <string.h>
 #include "display.h"
 
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
-uint32_t* color_buffer = NULL;
-float* z_buffer = NULL;
 int window_width = 800;
 int window_height = 600;
 SDL_Texture* color_buffer_texture = NULL;
+upscale_filter_t upscale_filter = upscale_bilinear;
 
-uint8_t wireframe = 0x1;
-uint8_t red_dot = 0x2;
-uint8_t filled_triangle = 0x4;
-uint8_t render_texture = 0x8;
-uint8_t rendering_mode;
-bool backface_culling = true;
+// Whether color_buffer_texture is locked and the frame is being drawn straight into it
+static bool color_buffer_locked = false;
+
+// Scratch for scaling framebuffers, which are never larger than the window, up to it
+static upscale_buffers_t upscale_buffers;
 
 bool initialize_window(void) {
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
@@ -46,53 +46,93 @@ bool initialize_window(void) {
 
 	//SDL_SetWindowFullscreen(window, SDL_WINDOW_FULLSCREEN);
 
-	return true;
-}
+	if (!upscale_buffers_init(&upscale_buffers, window_width, window_width)) {
+		fprintf(stderr, "Failed to allocate the upscale buffers!\n");
+		return false;
+	}
 
-void render_color_buffer(void) {
-	SDL_UpdateTexture(color_buffer_texture, NULL, color_buffer, (int)(window_width * sizeof(uint32_t)));
-	SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
+	return true;
 }
 
-void clear_color_buffer(uint32_t color) {
-	for (int y = 0; y < window_height; y++) {
-		for (int x = 0; x < window_width; x++) {
-			color_buffer[(window_width * y) + x] = color;
+///////////////////////////////////////////////////////////////////////////////
+// Copy a framebuffer that was drawn in its own memory into the streaming
+// texture. A tiled one is linearized into the locked texture, honoring its
+// pitch, a linear one is uploaded as it is. One drawn smaller than the
+// window is scaled up to it with upscale_filter on the way.
+///////////////////////////////////////////////////////////////////////////////
+void present_framebuffer(const framebuffer_t* source) {
+	void* pixels;
+	int pitch;
+	if (source->width != window_width || source->height != window_height) {
+		// Its planes are smaller than the texture, so it can only go in through the upscale
+		if (SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch) == 0) {
+			framebuffer_upscale(source, &upscale_buffers, (uint32_t*)pixels, pitch, window_width, window_height, upscale_filter);
+			SDL_UnlockTexture(color_buffer_texture);
 		}
+	} else if (source->layout == framebuffer_tiled && SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch) == 0) {
+		framebuffer_linearize(source, (uint32_t*)pixels, pitch);
+		SDL_UnlockTexture(color_buffer_texture);
+	} else {
+		SDL_UpdateTexture(color_buffer_texture, NULL, source->color, (int)(source->stride * sizeof(uint32_t)));
 	}
+	SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
 }
 
-void clear_z_buffer(void) {
-	for (int y = 0; y < window_height; y++) {
-		for (int x = 0; x < window_width; x++) {
-			z_buffer[(window_width * y) + x] = 1.0;
-		}
+///////////////////////////////////////////////////////////////////////////////
+// Hand the frame to SDL. A linear framebuffer drawn right into the locked
+// streaming texture only has to be unlocked, anything else is copied in.
+///////////////////////////////////////////////////////////////////////////////
+void render_color_buffer(framebuffer_t* source) {
+	if (!color_buffer_locked) {
+		present_framebuffer(source);
+		return;
 	}
+	SDL_UnlockTexture(color_buffer_texture);
+	framebuffer_unbind_color(source);
+	color_buffer_locked = false;
+	SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
 }
 
-void draw_grid(void) {
-	for (int y = 0; y < window_height; y++) {
-		for (int x = 0; x < window_width; x++) {
-			if (y % 10 == 0 || x % 10 == 0)
-				color_buffer[(window_width * y) + x] = 0xFF222222;
-		}
+///////////////////////////////////////////////////////////////////////////////
+// Point a linear framebuffer's color plane at the streaming texture, so the
+// frame about to be drawn needs no copy to be presented. It stays locked
+// until render_color_buffer, which has to be on the same thread. Only one
+// of the window's size can draw straight into it.
+///////////////////////////////////////////////////////////////////////////////
+void begin_color_buffer(framebuffer_t* target) {
+	void* pixels;
+	int pitch;
+	if (target->layout != framebuffer_linear || color_buffer_locked)
+		return;
+	if (target->width != window_width || target->height != window_height)
+		return;
+	if (SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch) != 0)
+		return;
+	if (!framebuffer_bind_color(target, (uint32_t*)pixels, pitch)) {
+		SDL_UnlockTexture(color_buffer_texture);
+		return;
 	}
+	color_buffer_locked = true;
 }
 
-void draw_pixel(int x, int y, uint32_t color) {
-	if (x >= 0 && x < window_width && y >= 0 && y < window_height)
-		color_buffer[window_width * y + x] = color;
+// Lines and dots cover whole pixels, a multisampled edge pixel is one color again
+void draw_pixel(framebuffer_t* target, int x, int y, uint32_t color) {
+	if (!framebuffer_contains(target, x, y))
+		return;
+	target->color[framebuffer_offset(target, x, y)] = color;
+	if (target->edge != NULL)
+		target->edge[framebuffer_sample_index(target, x, y)] = 0;
 }
 
-void draw_rect(int x, int y, int width, int height, uint32_t color) {
+void draw_rect(framebuffer_t* target, int x, int y, int width, int height, uint32_t color) {
 	for (int row = y; row < y + height; row++) {
 		for (int col = x; col < x + width; col++) {
-			draw_pixel(col, row, color);
+			draw_pixel(target, col, row, color);
 		}
 	}
 }
 
-void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
+void draw_line(framebuffer_t* target, int x0, int y0, int x1, int y1, uint32_t color) {
 	int delta_x = x1 - x0;
 	int delta_y = y1 - y0;
 
@@ -105,13 +145,14 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color) {
 	float current_y = y0;
 
 	for (int i = 0; i <= longest_side_length; i++) {
-		draw_pixel(round(current_x), round(current_y), color);
+		draw_pixel(target, round(current_x), round(current_y), color);
 		current_x += x_inc;
 		current_y += y_inc;
 	}
 }
 
 void destroy_window(void) {
+	upscale_buffers_free(&upscale_buffers);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
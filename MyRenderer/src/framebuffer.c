@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "framebuffer.h"
+#include "color.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRAMEBUFFER_USE_SSE2
+#endif
+
+#define TILE_PIXELS (FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE)
+
+// 4 byte values in each plane at the largest size, padded to whole tiles when tiled
+static size_t plane_size(const framebuffer_t* framebuffer, int stride) {
+	size_t size = framebuffer->layout == framebuffer_tiled ?
+		(size_t)((framebuffer->max_width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE) *
+		((framebuffer->max_height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE) * TILE_PIXELS :
+		(size_t)stride * framebuffer->max_height;
+	return (size + 15) & ~(size_t)15; // keep the depth plane on a cache line
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Lay out the offset tables for the current size within the planes. In the
+// tiled layout every tile is a 512 byte record, 64 colors then 64 depths, so
+// the pixels a small triangle touches fit in a handful of L1 lines. Linear
+// rows are stride pixels apart.
+///////////////////////////////////////////////////////////////////////////////
+static void layout_planes(framebuffer_t* framebuffer) {
+	int width = framebuffer->width;
+	int height = framebuffer->height;
+	if (framebuffer->layout == framebuffer_tiled) {
+		// The depth of a pixel sits one tile's worth of colors after its color
+		framebuffer->depth = (float*)(framebuffer->own_color + TILE_PIXELS);
+		for (int x = 0; x < width; x++)
+			framebuffer->offset_x[x] = (x / FRAMEBUFFER_TILE_SIZE) * TILE_PIXELS * 2 + (x % FRAMEBUFFER_TILE_SIZE);
+		for (int y = 0; y < height; y++)
+			framebuffer->offset_y[y] = (y / FRAMEBUFFER_TILE_SIZE) * framebuffer->tiles_x * TILE_PIXELS * 2 + (y % FRAMEBUFFER_TILE_SIZE) * FRAMEBUFFER_TILE_SIZE;
+	} else {
+		framebuffer->depth = (float*)(framebuffer->own_color + plane_size(framebuffer, framebuffer->stride));
+		for (int x = 0; x < width; x++)
+			framebuffer->offset_x[x] = x;
+		for (int y = 0; y < height; y++)
+			framebuffer->offset_y[y] = y * framebuffer->stride;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocate both planes in one block aligned to a cache line, with room for
+// the size the framebuffer was created with, and lay them out
+///////////////////////////////////////////////////////////////////////////////
+static bool allocate_planes(framebuffer_t* framebuffer, int stride) {
+	void* memory = malloc(plane_size(framebuffer, stride) * 2 * sizeof(uint32_t) + FRAMEBUFFER_ALIGNMENT);
+	if (memory == NULL)
+		return false;
+	free(framebuffer->memory);
+	framebuffer->memory = memory;
+	framebuffer->stride = stride;
+
+	uintptr_t aligned = ((uintptr_t)memory + FRAMEBUFFER_ALIGNMENT - 1) & ~(uintptr_t)(FRAMEBUFFER_ALIGNMENT - 1);
+	framebuffer->own_color = framebuffer->color = (uint32_t*)aligned;
+	layout_planes(framebuffer);
+	return true;
+}
+
+framebuffer_t* framebuffer_create(int width, int height, framebuffer_layout_t layout) {
+	framebuffer_t* framebuffer = (framebuffer_t*)calloc(1, sizeof(framebuffer_t));
+	if (framebuffer == NULL)
+		return NULL;
+
+	framebuffer->width = width;
+	framebuffer->height = height;
+	framebuffer->max_width = width;
+	framebuffer->max_height = height;
+	framebuffer->layout = layout;
+	framebuffer->tiles_x = (width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	framebuffer->tiles_y = (height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	framebuffer->clip_top = 0;
+	framebuffer->clip_bottom = height;
+
+	framebuffer->offset_x = (uint32_t*)malloc(sizeof(uint32_t) * width);
+	framebuffer->offset_y = (uint32_t*)malloc(sizeof(uint32_t) * height);
+	if (framebuffer->offset_x == NULL || framebuffer->offset_y == NULL || !allocate_planes(framebuffer, width)) {
+		framebuffer_destroy(framebuffer);
+		return NULL;
+	}
+	return framebuffer;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw at another size, up to the one the framebuffer was created with. Every
+// plane already has room for that, so only the offset tables are laid out
+// again and nothing is allocated, but the contents are lost. It must not be
+// resized while its color is bound.
+///////////////////////////////////////////////////////////////////////////////
+bool framebuffer_resize(framebuffer_t* framebuffer, int width, int height) {
+	if (width == framebuffer->width && height == framebuffer->height)
+		return true;
+	if (width < 1 || height < 1 || width > framebuffer->max_width || height > framebuffer->max_height || framebuffer->color != framebuffer->own_color)
+		return false;
+
+	framebuffer->width = width;
+	framebuffer->height = height;
+	framebuffer->tiles_x = (width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	framebuffer->tiles_y = (height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+	framebuffer->clip_top = 0;
+	framebuffer->clip_bottom = height;
+	layout_planes(framebuffer);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the colors of a linear framebuffer straight into outside memory, such
+// as a locked streaming texture, whose rows are pitch bytes apart. The depth
+// plane is laid out again with the same stride the first time a new pitch
+// comes along, so both planes keep sharing the offset tables.
+///////////////////////////////////////////////////////////////////////////////
+bool framebuffer_bind_color(framebuffer_t* framebuffer, uint32_t* pixels, int pitch) {
+	if (framebuffer->layout != framebuffer_linear || pitch % sizeof(uint32_t) != 0)
+		return false;
+	int stride = pitch / (int)sizeof(uint32_t);
+	if (stride < framebuffer->width)
+		return false;
+	if (stride != framebuffer->stride && !allocate_planes(framebuffer, stride))
+		return false;
+	framebuffer->color = pixels;
+	return true;
+}
+
+// Go back to drawing into the framebuffer's own color plane
+void framebuffer_unbind_color(framebuffer_t* framebuffer) {
+	framebuffer->color = framebuffer->own_color;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A view of the same planes that only draws in the rows [top, bottom), so
+// threads can each draw a band of the frame without touching the others.
+// The view owns nothing and must not be destroyed.
+///////////////////////////////////////////////////////////////////////////////
+framebuffer_t framebuffer_rows(const framebuffer_t* framebuffer, int top, int bottom) {
+	framebuffer_t view = *framebuffer;
+	view.clip_top = top > framebuffer->clip_top ? top : framebuffer->clip_top;
+	view.clip_bottom = bottom < framebuffer->clip_bottom ? bottom : framebuffer->clip_bottom;
+	return view;
+}
+
+void framebuffer_destroy(framebuffer_t* framebuffer) {
+	if (framebuffer == NULL)
+		return;
+	free(framebuffer->memory);
+	free(framebuffer->offset_x);
+	free(framebuffer->offset_y);
+	free(framebuffer->sample_depth);
+	free(framebuffer->sample_color);
+	free(framebuffer->edge);
+	free(framebuffer->shading_rate);
+	free(framebuffer);
+}
+
+// Give the framebuffer a shading rate per tile, every tile at the full rate to start with
+bool framebuffer_enable_shading_rates(framebuffer_t* framebuffer) {
+	if (framebuffer->shading_rate == NULL)
+		framebuffer->shading_rate = (uint8_t*)calloc((size_t)framebuffer->tiles_x * framebuffer->tiles_y, sizeof(uint8_t));
+	return framebuffer->shading_rate != NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Set the shading rates around where the eye is: the tiles within radius of
+// the center shade every pixel, those within twice the radius every 2x2
+// block, and the rest every 4x4 block
+///////////////////////////////////////////////////////////////////////////////
+void framebuffer_foveate(framebuffer_t* framebuffer, float center_x, float center_y, float radius) {
+	if (framebuffer->shading_rate == NULL)
+		return;
+	for (int tile_y = 0; tile_y < framebuffer->tiles_y; tile_y++) {
+		for (int tile_x = 0; tile_x < framebuffer->tiles_x; tile_x++) {
+			float dx = (tile_x + 0.5f) * FRAMEBUFFER_TILE_SIZE - center_x;
+			float dy = (tile_y + 0.5f) * FRAMEBUFFER_TILE_SIZE - center_y;
+			float distance = sqrtf(dx * dx + dy * dy);
+			int rate = 0;
+			while (rate < FRAMEBUFFER_MAX_SHADING_RATE && distance > radius * (rate + 1))
+				rate++;
+			framebuffer->shading_rate[tile_y * framebuffer->tiles_x + tile_x] = (uint8_t)rate;
+		}
+	}
+}
+
+
+// Set count depth values, four at a time where SSE2 is there
+static void fill_depth(float* depth, int count, float value) {
+	int i = 0;
+#ifdef FRAMEBUFFER_USE_SSE2
+	const __m128 values = _mm_set1_ps(value);
+	for (; i + 4 <= count; i += 4) {
+		_mm_storeu_ps(depth + i, values);
+	}
+#endif
+	for (; i < count; i++) {
+		depth[i] = value;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Give every pixel FRAMEBUFFER_SAMPLES samples, each with its own depth. The
+// sample colors are only written for pixels on the edge of a triangle, all
+// the others keep a single color in the color plane.
+///////////////////////////////////////////////////////////////////////////////
+bool framebuffer_enable_multisampling(framebuffer_t* framebuffer) {
+	if (framebuffer->edge != NULL)
+		return true;
+	size_t pixels = (size_t)framebuffer->width * framebuffer->height;
+	framebuffer->sample_depth = (float*)malloc(sizeof(float) * FRAMEBUFFER_SAMPLES * pixels);
+	framebuffer->sample_color = (uint32_t*)malloc(sizeof(uint32_t) * FRAMEBUFFER_SAMPLES * pixels);
+	framebuffer->edge = (uint8_t*)calloc(pixels, sizeof(uint8_t));
+	if (framebuffer->sample_depth == NULL || framebuffer->sample_color == NULL || framebuffer->edge == NULL) {
+		free(framebuffer->sample_depth);
+		free(framebuffer->sample_color);
+		free(framebuffer->edge);
+		framebuffer->sample_depth = NULL;
+		framebuffer->sample_color = NULL;
+		framebuffer->edge = NULL;
+		return false;
+	}
+	fill_depth(framebuffer->sample_depth, (int)(FRAMEBUFFER_SAMPLES * pixels), 1.0f);
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start a frame in a single pass: copy the background colors in and reset the
+// depth to the far plane, one tile (or row when linear) at a time.
+// background is a linear image at least the framebuffer size with rows
+// background_stride pixels apart, so a smaller framebuffer takes its top
+// left corner. When multisampled the sample depths are reset instead and
+// every pixel is one color again.
+///////////////////////////////////////////////////////////////////////////////
+void framebuffer_clear(framebuffer_t* framebuffer, const uint32_t* background, int background_stride) {
+	int width = framebuffer->width;
+	int height = framebuffer->height;
+	bool multisampled = framebuffer->edge != NULL;
+
+	if (multisampled) {
+		memset(framebuffer->edge, 0, (size_t)width * height);
+		fill_depth(framebuffer->sample_depth, FRAMEBUFFER_SAMPLES * width * height, 1.0f);
+	}
+
+	if (framebuffer->layout == framebuffer_linear) {
+		for (int y = 0; y < height; y++) {
+			uint32_t offset = framebuffer->offset_y[y];
+			memcpy(framebuffer->color + offset, background + (size_t)background_stride * y, sizeof(uint32_t) * width);
+			if (!multisampled)
+				fill_depth(framebuffer->depth + offset, width, 1.0f);
+		}
+		return;
+	}
+
+	for (int tile_y = 0; tile_y < framebuffer->tiles_y; tile_y++) {
+		int y0 = tile_y * FRAMEBUFFER_TILE_SIZE;
+		int rows = height - y0 < FRAMEBUFFER_TILE_SIZE ? height - y0 : FRAMEBUFFER_TILE_SIZE;
+		for (int tile_x = 0; tile_x < framebuffer->tiles_x; tile_x++) {
+			int x0 = tile_x * FRAMEBUFFER_TILE_SIZE;
+			int columns = width - x0 < FRAMEBUFFER_TILE_SIZE ? width - x0 : FRAMEBUFFER_TILE_SIZE;
+			uint32_t offset = framebuffer_offset(framebuffer, x0, y0);
+			for (int row = 0; row < rows; row++) {
+				memcpy(framebuffer->color + offset + row * FRAMEBUFFER_TILE_SIZE, background + (size_t)(y0 + row) * background_stride + x0, sizeof(uint32_t) * columns);
+			}
+			if (!multisampled)
+				fill_depth(framebuffer->depth + offset, TILE_PIXELS, 1.0f);
+		}
+	}
+}
+
+// Reset only the depth plane, for a framebuffer drawn depth only
+void framebuffer_clear_depth(framebuffer_t* framebuffer, float value) {
+	if (framebuffer->layout == framebuffer_linear) {
+		for (int y = 0; y < framebuffer->height; y++)
+			fill_depth(framebuffer->depth + framebuffer->offset_y[y], framebuffer->width, value);
+		return;
+	}
+	for (int tile = 0; tile < framebuffer->tiles_x * framebuffer->tiles_y; tile++)
+		fill_depth(framebuffer->depth + (size_t)tile * TILE_PIXELS * 2, TILE_PIXELS, value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Average the samples of the edge pixels of rows [clip_top, clip_bottom) into
+// their colors, so a band can be resolved by the thread that drew it
+///////////////////////////////////////////////////////////////////////////////
+void framebuffer_resolve(framebuffer_t* framebuffer) {
+	if (framebuffer->edge == NULL)
+		return;
+	for (int y = framebuffer->clip_top; y < framebuffer->clip_bottom; y++) {
+		uint32_t row = framebuffer_sample_index(framebuffer, 0, y);
+		for (int x = 0; x < framebuffer->width; x++) {
+			if (!framebuffer->edge[row + x])
+				continue;
+			const uint32_t* samples = framebuffer->sample_color + FRAMEBUFFER_SAMPLES * (row + x);
+			framebuffer->color[framebuffer_offset(framebuffer, x, y)] = color_average(samples[0], samples[1], samples[2], samples[3]);
+		}
+	}
+}
+
+// Copy the colors of row y out in order
+static void copy_row(const framebuffer_t* framebuffer, int y, uint32_t* row) {
+	int width = framebuffer->width;
+	if (framebuffer->layout == framebuffer_linear) {
+		memcpy(row, framebuffer->color + framebuffer->offset_y[y], sizeof(uint32_t) * width);
+		return;
+	}
+	for (int x = 0; x < width; x += FRAMEBUFFER_TILE_SIZE) {
+		int columns = width - x < FRAMEBUFFER_TILE_SIZE ? width - x : FRAMEBUFFER_TILE_SIZE;
+		memcpy(row + x, framebuffer->color + framebuffer_offset(framebuffer, x, y), sizeof(uint32_t) * columns);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy the colors out as a row-major image, pitch is in bytes
+///////////////////////////////////////////////////////////////////////////////
+void framebuffer_linearize(const framebuffer_t* framebuffer, uint32_t* pixels, int pitch) {
+	for (int y = 0; y < framebuffer->height; y++)
+		copy_row(framebuffer, y, (uint32_t*)((unsigned char*)pixels + (size_t)y * pitch));
+}
+
+// Where the middle of pixel i of a size long image falls among the framebuffer's source_size pixels
+static float upscale_position(int i, int size, int source_size) {
+	float position = (i + 0.5f) * source_size / size - 0.5f;
+	return position < 0 ? 0 : position;
+}
+
+// Room to scale framebuffers up to max_source_width wide to images up to max_width wide
+bool upscale_buffers_init(upscale_buffers_t* buffers, int max_source_width, int max_width) {
+	buffers->max_source_width = max_source_width;
+	buffers->max_width = max_width;
+	buffers->rows = (uint32_t*)malloc(sizeof(uint32_t) * max_source_width * 3);
+	buffers->columns = (int*)malloc(sizeof(int) * max_width);
+	buffers->weights = (uint32_t*)malloc(sizeof(uint32_t) * max_width);
+	if (buffers->rows == NULL || buffers->columns == NULL || buffers->weights == NULL) {
+		upscale_buffers_free(buffers);
+		return false;
+	}
+	return true;
+}
+
+void upscale_buffers_free(upscale_buffers_t* buffers) {
+	free(buffers->rows);
+	free(buffers->columns);
+	free(buffers->weights);
+	buffers->rows = NULL;
+	buffers->columns = NULL;
+	buffers->weights = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Scale the colors up (or down) to a width x height row-major image, pitch in
+// bytes, false if the buffers are too small for either. Bilinear first blends
+// the two source rows around an image row, a whole row at a time with the
+// packed color math, then blends across it.
+///////////////////////////////////////////////////////////////////////////////
+bool framebuffer_upscale(const framebuffer_t* framebuffer, upscale_buffers_t* buffers, uint32_t* pixels, int pitch, int width, int height, upscale_filter_t filter) {
+	int source_width = framebuffer->width;
+	int source_height = framebuffer->height;
+	if (source_width > buffers->max_source_width || width > buffers->max_width)
+		return false;
+
+	// Two source rows, their blend, and for every image column its left source column and weight
+	int* columns = buffers->columns;
+	uint32_t* weights = buffers->weights;
+	uint32_t* top = buffers->rows;
+	uint32_t* bottom = buffers->rows + source_width;
+	uint32_t* blend = buffers->rows + source_width * 2;
+	int top_y = -1, bottom_y = -1;
+
+	for (int x = 0; x < width; x++) {
+		if (filter == upscale_nearest) {
+			columns[x] = (int)((long long)x * source_width / width);
+			weights[x] = 0;
+			continue;
+		}
+		float position = upscale_position(x, width, source_width);
+		columns[x] = (int)position;
+		weights[x] = (uint32_t)((position - columns[x]) * COLOR_ONE);
+		if (columns[x] >= source_width - 1) {
+			columns[x] = source_width - 1;
+			weights[x] = 0;
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		uint32_t* row = (uint32_t*)((unsigned char*)pixels + (size_t)y * pitch);
+
+		if (filter == upscale_nearest) {
+			int source_y = (int)((long long)y * source_height / height);
+			if (source_y != top_y) {
+				copy_row(framebuffer, source_y, top);
+				top_y = source_y;
+			}
+			for (int x = 0; x < width; x++)
+				row[x] = top[columns[x]];
+			continue;
+		}
+
+		float position = upscale_position(y, height, source_height);
+		int y0 = (int)position;
+		int y1 = y0 + 1 < source_height ? y0 + 1 : y0;
+		uint32_t ty = (uint32_t)((position - y0) * COLOR_ONE);
+
+		// The rows only change every few image rows, keep the ones already copied
+		if (y0 == bottom_y) {
+			uint32_t* swap = top;
+			top = bottom;
+			bottom = swap;
+			top_y = bottom_y;
+			bottom_y = -1;
+		}
+		if (y0 != top_y) {
+			copy_row(framebuffer, y0, top);
+			top_y = y0;
+		}
+		if (y1 != bottom_y) {
+			copy_row(framebuffer, y1, bottom);
+			bottom_y = y1;
+		}
+
+		color_lerp_row(blend, top, bottom, source_width, ty);
+		for (int x = 0; x < width; x++) {
+			int column = columns[x];
+			row[x] = weights[x] == 0 ? blend[column] : color_lerp(blend[column], blend[column + 1], weights[x]);
+		}
+	}
+	return true;
+}
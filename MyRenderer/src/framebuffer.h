@@ -0,0 +1,100 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define FRAMEBUFFER_TILE_SIZE 8
+#define FRAMEBUFFER_ALIGNMENT 64 // cache line
+#define FRAMEBUFFER_SAMPLES 4    // samples per pixel when multisampled
+#define FRAMEBUFFER_MAX_SHADING_RATE 2 // shading once per 4x4 block of pixels at the coarsest
+
+typedef enum {
+	framebuffer_linear, // a row-major color plane followed by a row-major depth plane
+	framebuffer_tiled   // 8x8 pixel tiles, each one holding its 64 colors then its 64 depths
+} framebuffer_layout_t;
+
+typedef enum {
+	upscale_nearest,  // each pixel of the image takes the closest framebuffer pixel
+	upscale_bilinear  // each pixel of the image blends the four closest framebuffer pixels
+} upscale_filter_t;
+
+// Scratch for framebuffer_upscale, made once for the largest sizes it will see
+typedef struct {
+	int max_source_width;
+	int max_width;
+	uint32_t* rows;    // two framebuffer rows and their blend
+	int* columns;      // framebuffer column left of each image column
+	uint32_t* weights; // weight of the column right of it
+} upscale_buffers_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Color and depth of the frame being drawn. Like texture levels, both layouts
+// are separable: pixel (x,y) lives at offset_x[x] + offset_y[y] in color and
+// in depth, whose planes are placed so a tile keeps the two side by side.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	int width;
+	int height;
+	int max_width;  // the size it was created with, the largest it can be resized to
+	int max_height;
+	framebuffer_layout_t layout;
+	int tiles_x;
+	int tiles_y;
+	int stride; // pixels from one row to the next in the linear layout
+	int clip_top;    // drawing is limited to the rows [clip_top, clip_bottom)
+	int clip_bottom;
+	uint32_t* color;
+	float* depth;
+	uint32_t* offset_x;
+	uint32_t* offset_y;
+	uint32_t* own_color; // color plane in memory, color points elsewhere while one is bound
+	void* memory;        // unaligned block holding both planes
+
+	// Multisampled only, NULL otherwise: pixel (x,y) has its samples at framebuffer_sample_index
+	float* sample_depth;    // the depth of every sample, taking over from the depth plane
+	uint32_t* sample_color; // the color of every sample, only up to date where edge is set
+	uint8_t* edge;          // 1 where the samples of a pixel differ, else they all have the pixel's color
+
+	// Per tile, log2 of the size of the pixel blocks that share one shading: 0
+	// shades every pixel, 1 each 2x2 block, 2 each 4x4. NULL to shade every pixel.
+	uint8_t* shading_rate;
+} framebuffer_t;
+
+framebuffer_t* framebuffer_create(int width, int height, framebuffer_layout_t layout);
+void framebuffer_destroy(framebuffer_t* framebuffer);
+bool framebuffer_resize(framebuffer_t* framebuffer, int width, int height);
+void framebuffer_clear(framebuffer_t* framebuffer, const uint32_t* background, int background_stride);
+void framebuffer_clear_depth(framebuffer_t* framebuffer, float value);
+bool framebuffer_bind_color(framebuffer_t* framebuffer, uint32_t* pixels, int pitch);
+void framebuffer_unbind_color(framebuffer_t* framebuffer);
+framebuffer_t framebuffer_rows(const framebuffer_t* framebuffer, int top, int bottom);
+void framebuffer_linearize(const framebuffer_t* framebuffer, uint32_t* pixels, int pitch);
+bool upscale_buffers_init(upscale_buffers_t* buffers, int max_source_width, int max_width);
+void upscale_buffers_free(upscale_buffers_t* buffers);
+bool framebuffer_upscale(const framebuffer_t* framebuffer, upscale_buffers_t* buffers, uint32_t* pixels, int pitch, int width, int height, upscale_filter_t filter);
+bool framebuffer_enable_multisampling(framebuffer_t* framebuffer);
+void framebuffer_resolve(framebuffer_t* framebuffer);
+bool framebuffer_enable_shading_rates(framebuffer_t* framebuffer);
+void framebuffer_foveate(framebuffer_t* framebuffer, float center_x, float center_y, float radius);
+
+static inline uint32_t framebuffer_offset(const framebuffer_t* framebuffer, int x, int y) {
+	return framebuffer->offset_x[x] + framebuffer->offset_y[y];
+}
+
+// Index of pixel (x,y) in edge, its samples start at FRAMEBUFFER_SAMPLES times that
+static inline uint32_t framebuffer_sample_index(const framebuffer_t* framebuffer, int x, int y) {
+	return (uint32_t)y * framebuffer->width + x;
+}
+
+static inline int framebuffer_shading_rate(const framebuffer_t* framebuffer, int x, int y) {
+	if (framebuffer->shading_rate == NULL)
+		return 0;
+	return framebuffer->shading_rate[(y / FRAMEBUFFER_TILE_SIZE) * framebuffer->tiles_x + x / FRAMEBUFFER_TILE_SIZE];
+}
+
+static inline bool framebuffer_contains(const framebuffer_t* framebuffer, int x, int y) {
+	return x >= 0 && x < framebuffer->width && y >= framebuffer->clip_top && y < framebuffer->clip_bottom;
+}
+
+#endif
@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "job.h"
+
+typedef struct {
+	job_function_t function;
+	void* data;
+	int begin;
+	int end;
+	job_counter_t* counter;
+} job_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Every thread owns a deque of jobs. The owner pushes and pops at the bottom,
+// so it keeps working on what it split last while that data is still in the
+// cache, and idle threads steal from the top, which holds the biggest and
+// oldest pieces of work. Deque 0 is shared by threads that are not workers.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	SDL_SpinLock lock;
+	int top;
+	int bottom;
+	job_t jobs[JOB_DEQUE_SIZE];
+} job_deque_t;
+
+int job_threads = 0;
+
+static job_deque_t* deques = NULL;
+static int num_deques = 0;
+static SDL_Thread* workers[JOB_MAX_THREADS];
+static SDL_threadID worker_ids[JOB_MAX_THREADS];
+static int num_workers = 0;
+static SDL_sem* work_available = NULL;
+static SDL_atomic_t running;
+
+// Deque of the calling thread: its own for a worker, the shared one for anybody else
+static job_deque_t* own_deque(void) {
+	SDL_threadID id = SDL_ThreadID();
+	for (int i = 0; i < num_workers; i++) {
+		if (worker_ids[i] == id)
+			return &deques[i + 1];
+	}
+	return &deques[0];
+}
+
+static bool deque_push(job_deque_t* deque, const job_t* job) {
+	bool pushed = false;
+	SDL_AtomicLock(&deque->lock);
+	if (deque->bottom - deque->top < JOB_DEQUE_SIZE) {
+		deque->jobs[deque->bottom % JOB_DEQUE_SIZE] = *job;
+		deque->bottom++;
+		pushed = true;
+	}
+	SDL_AtomicUnlock(&deque->lock);
+	return pushed;
+}
+
+static bool deque_pop(job_deque_t* deque, job_t* job) {
+	bool popped = false;
+	SDL_AtomicLock(&deque->lock);
+	if (deque->bottom > deque->top) {
+		deque->bottom--;
+		*job = deque->jobs[deque->bottom % JOB_DEQUE_SIZE];
+		popped = true;
+	}
+	SDL_AtomicUnlock(&deque->lock);
+	return popped;
+}
+
+static bool deque_steal(job_deque_t* deque, job_t* job) {
+	bool stolen = false;
+	SDL_AtomicLock(&deque->lock);
+	if (deque->bottom > deque->top) {
+		*job = deque->jobs[deque->top % JOB_DEQUE_SIZE];
+		deque->top++;
+		stolen = true;
+	}
+	SDL_AtomicUnlock(&deque->lock);
+	return stolen;
+}
+
+static void job_execute(const job_t* job) {
+	job->function(job->data, job->begin, job->end);
+	if (job->counter != NULL)
+		SDL_AtomicAdd(&job->counter->pending, -1);
+}
+
+// Take a job from the own deque, or steal one from the others starting at a neighbour
+static bool job_find(job_deque_t* deque, job_t* job) {
+	if (deque_pop(deque, job))
+		return true;
+	int self = (int)(deque - deques);
+	for (int i = 1; i < num_deques; i++) {
+		if (deque_steal(&deques[(self + i) % num_deques], job))
+			return true;
+	}
+	return false;
+}
+
+static int worker_run(void* data) {
+	job_deque_t* deque = (job_deque_t*)data;
+	job_t job;
+	while (SDL_AtomicGet(&running)) {
+		if (job_find(deque, &job))
+			job_execute(&job);
+		else
+			SDL_SemWait(work_available);
+	}
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start job_threads - 1 workers, the thread waiting on a job is the last one.
+// job_threads left at 0 takes one thread per CPU.
+///////////////////////////////////////////////////////////////////////////////
+bool jobs_init(void) {
+	if (job_threads <= 0)
+		job_threads = SDL_GetCPUCount();
+	if (job_threads > JOB_MAX_THREADS)
+		job_threads = JOB_MAX_THREADS;
+	if (job_threads <= 1) {
+		job_threads = 1;
+		return true;
+	}
+
+	num_deques = job_threads;
+	deques = (job_deque_t*)calloc(num_deques, sizeof(job_deque_t));
+	work_available = SDL_CreateSemaphore(0);
+	if (deques == NULL || work_available == NULL) {
+		fprintf(stderr, "Failed to start the job system, running jobs inline\n");
+		jobs_shutdown();
+		return false;
+	}
+
+	SDL_AtomicSet(&running, 1);
+	for (int i = 0; i < job_threads - 1; i++) {
+		workers[num_workers] = SDL_CreateThread(worker_run, "job worker", &deques[num_workers + 1]);
+		if (workers[num_workers] == NULL)
+			break;
+		worker_ids[num_workers] = SDL_GetThreadID(workers[num_workers]);
+		num_workers++;
+	}
+	return true;
+}
+
+void jobs_shutdown(void) {
+	SDL_AtomicSet(&running, 0);
+	for (int i = 0; i < num_workers; i++)
+		SDL_SemPost(work_available);
+	for (int i = 0; i < num_workers; i++)
+		SDL_WaitThread(workers[i], NULL);
+	num_workers = 0;
+
+	if (work_available != NULL)
+		SDL_DestroySemaphore(work_available);
+	work_available = NULL;
+	free(deques);
+	deques = NULL;
+	num_deques = 0;
+	job_threads = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Queue a job for any thread to run, counting it in counter if there is one.
+// With a single thread, or a full deque, the job runs before this returns.
+///////////////////////////////////////////////////////////////////////////////
+void job_run(job_function_t function, void* data, int begin, int end, job_counter_t* counter) {
+	job_t job = { function, data, begin, end, counter };
+	if (counter != NULL)
+		SDL_AtomicAdd(&counter->pending, 1);
+
+	if (num_workers == 0 || !deque_push(own_deque(), &job)) {
+		job_execute(&job);
+		return;
+	}
+	SDL_SemPost(work_available);
+}
+
+// Run queued jobs until every job counted in counter is done
+void job_wait(job_counter_t* counter) {
+	if (num_workers == 0)
+		return;
+	job_deque_t* deque = own_deque();
+	job_t job;
+	while (SDL_AtomicGet(&counter->pending) > 0) {
+		if (job_find(deque, &job))
+			job_execute(&job);
+		else
+			SDL_Delay(0);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run function over [0, count) in pieces of grain items and return once all
+// of them are done. A grain of 0 or less makes about four pieces per thread.
+///////////////////////////////////////////////////////////////////////////////
+void parallel_for(job_function_t function, void* data, int count, int grain) {
+	if (grain <= 0)
+		grain = (count + job_threads * 4 - 1) / (job_threads * 4);
+	if (grain <= 0)
+		grain = 1;
+	if (num_workers == 0 || count <= grain) {
+		if (count > 0)
+			function(data, 0, count);
+		return;
+	}
+
+	job_counter_t counter;
+	SDL_AtomicSet(&counter.pending, 0);
+	for (int begin = 0; begin < count; begin += grain) {
+		int end = begin + grain < count ? begin + grain : count;
+		job_run(function, data, begin, end, &counter);
+	}
+	job_wait(&counter);
+}
@@ -0,0 +1,26 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <SDL.h>
+#include <stdbool.h>
+
+#define JOB_DEQUE_SIZE 1024 // jobs a thread can have queued, more are run right away
+#define JOB_MAX_THREADS 64
+
+// Work on the items [begin, end) of whatever data points to
+typedef void (*job_function_t)(void* data, int begin, int end);
+
+// Counts the jobs still pending in a group, waiting on it waits for all of them
+typedef struct {
+	SDL_atomic_t pending;
+} job_counter_t;
+
+extern int job_threads; // threads running jobs including the caller, 1 runs every job inline
+
+bool jobs_init(void);
+void jobs_shutdown(void);
+void job_run(job_function_t function, void* data, int begin, int end, job_counter_t* counter);
+void job_wait(job_counter_t* counter);
+void parallel_for(job_function_t function, void* data, int count, int grain);
+
+#endif
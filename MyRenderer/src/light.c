@@ -1,17 +1,196 @@
+#include <stdlib.h>
+#include <math.h>
 #include "light.h"
+#include "simd_math.h"
 
-light_t light = { 
-	.direction = { .x = 0, .y = 0, .z = 1 } 
-};
-
-uint32_t light_apply_intensity(uint32_t original_color, float percentage_factor) {
-	if (percentage_factor < 0) percentage_factor = 0;
-	if (percentage_factor > 1) percentage_factor = 1;
-
-	uint32_t a = (original_color & 0xFF000000);
-	uint32_t r = (original_color & 0x00FF0000) * percentage_factor;
-	uint32_t g = (original_color & 0x0000FF00) * percentage_factor;
-	uint32_t b = (original_color & 0x000000FF) * percentage_factor;
-	uint32_t new_color = a | (r & 0x00FF0000) | (g & 0x0000FF00) | (b & 0x000000FF);
-	return new_color;
-}
\ No newline at end of file
+local_light_t light_make_point(vec3_t position, float radius, float intensity) {
+	local_light_t light = {
+		.type = light_point,
+		.position = position,
+		.radius = radius,
+		.intensity = intensity
+	};
+	return light;
+}
+
+// Angles are from the middle of the cone to its edge, in radians
+local_light_t light_make_spot(vec3_t position, vec3_t direction, float radius, float intensity, float inner_angle, float outer_angle) {
+	vec3_normalize_ref(&direction);
+	local_light_t light = {
+		.type = light_spot,
+		.position = position,
+		.radius = radius,
+		.intensity = intensity,
+		.direction = direction,
+		.cos_inner = cos(inner_angle),
+		.cos_outer = cos(outer_angle)
+	};
+	return light;
+}
+
+bool light_grid_init(light_grid_t* grid, int width, int height) {
+	grid->width = width;
+	grid->height = height;
+	grid->tiles_x = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	grid->tiles_y = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	grid->num_lights = 0;
+
+	int num_tiles = grid->tiles_x * grid->tiles_y;
+	grid->max_tiles = num_tiles;
+	grid->tile_start = (int*)calloc(num_tiles + 1, sizeof(int));
+	grid->indices = (uint8_t*)malloc((size_t)num_tiles * MAX_LIGHTS);
+	if (grid->tile_start == NULL || grid->indices == NULL) {
+		light_grid_free(grid);
+		return false;
+	}
+	return true;
+}
+
+// Cover a screen of another size with the buffers already made, false if it needs more tiles
+bool light_grid_resize(light_grid_t* grid, int width, int height) {
+	int tiles_x = (width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	int tiles_y = (height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+	if (tiles_x * tiles_y > grid->max_tiles)
+		return false;
+	grid->width = width;
+	grid->height = height;
+	grid->tiles_x = tiles_x;
+	grid->tiles_y = tiles_y;
+	return true;
+}
+
+void light_grid_free(light_grid_t* grid) {
+	free(grid->tile_start);
+	free(grid->indices);
+	grid->tile_start = NULL;
+	grid->indices = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Find the tiles [x0, x1] x [y0, y1] a light can touch, from the projection of
+// the corners of the box around its sphere. Returns false when the light is
+// off the screen. A box reaching behind the camera has no sound projection,
+// so the light then takes the whole screen.
+///////////////////////////////////////////////////////////////////////////////
+static bool light_tile_bounds(const light_grid_t* grid, const local_light_t* light, const mat4_t* proj_matrix, vec3_t camera_position, int* x0, int* y0, int* x1, int* y1) {
+	float min_x = INFINITY, min_y = INFINITY, max_x = -INFINITY, max_y = -INFINITY;
+	vec3_t center;
+	vec3_sub_ref(&center, &light->position, &camera_position);
+
+	for (int corner = 0; corner < 8; corner++) {
+		vec4_t point = {
+			center.x + (corner & 1 ? light->radius : -light->radius),
+			center.y + (corner & 2 ? light->radius : -light->radius),
+			center.z + (corner & 4 ? light->radius : -light->radius),
+			1.0f
+		};
+		vec4_t projected;
+		mat4_mul_vec4_project_ref(&projected, proj_matrix, &point);
+		if (projected.w <= 1e-3f) {
+			min_x = min_y = -INFINITY;
+			max_x = max_y = INFINITY;
+			break;
+		}
+
+		// Same mapping to the screen as the triangles
+		float x = projected.x * (grid->width / 2.0) + (grid->width / 2.0);
+		float y = -projected.y * (grid->height / 2.0) + (grid->height / 2.0);
+		min_x = x < min_x ? x : min_x;
+		max_x = x > max_x ? x : max_x;
+		min_y = y < min_y ? y : min_y;
+		max_y = y > max_y ? y : max_y;
+	}
+
+	if (max_x < 0 || max_y < 0 || min_x >= grid->width || min_y >= grid->height)
+		return false;
+	*x0 = min_x < 0 ? 0 : (int)min_x / LIGHT_TILE_SIZE;
+	*y0 = min_y < 0 ? 0 : (int)min_y / LIGHT_TILE_SIZE;
+	*x1 = max_x >= grid->width ? grid->tiles_x - 1 : (int)max_x / LIGHT_TILE_SIZE;
+	*y1 = max_y >= grid->height ? grid->tiles_y - 1 : (int)max_y / LIGHT_TILE_SIZE;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Take a copy of the lights for the frame and bin them to the tiles they can
+// reach on the screen, counting the lights of every tile first so each
+// tile's list is one run of the index array.
+///////////////////////////////////////////////////////////////////////////////
+void light_grid_build(light_grid_t* grid, const local_light_t* lights, int num_lights, const mat4_t* proj_matrix, vec3_t camera_position) {
+	int num_tiles = grid->tiles_x * grid->tiles_y;
+	int bounds[MAX_LIGHTS][4];
+	bool on_screen[MAX_LIGHTS];
+
+	if (num_lights > MAX_LIGHTS)
+		num_lights = MAX_LIGHTS;
+	grid->num_lights = num_lights;
+	for (int i = 0; i < num_lights; i++)
+		grid->lights[i] = lights[i];
+
+	// tile_start[t + 1] counts the lights of tile t for now
+	for (int tile = 0; tile <= num_tiles; tile++)
+		grid->tile_start[tile] = 0;
+	for (int i = 0; i < num_lights; i++) {
+		int* b = bounds[i];
+		on_screen[i] = light_tile_bounds(grid, &lights[i], proj_matrix, camera_position, &b[0], &b[1], &b[2], &b[3]);
+		if (!on_screen[i])
+			continue;
+		for (int tile_y = b[1]; tile_y <= b[3]; tile_y++) {
+			for (int tile_x = b[0]; tile_x <= b[2]; tile_x++)
+				grid->tile_start[tile_y * grid->tiles_x + tile_x + 1]++;
+		}
+	}
+
+	for (int tile = 0; tile < num_tiles; tile++)
+		grid->tile_start[tile + 1] += grid->tile_start[tile];
+
+	// Fill the lists, moving tile_start[t] to the end of tile t's list on the way, then shift it back
+	for (int i = 0; i < num_lights; i++) {
+		if (!on_screen[i])
+			continue;
+		int* b = bounds[i];
+		for (int tile_y = b[1]; tile_y <= b[3]; tile_y++) {
+			for (int tile_x = b[0]; tile_x <= b[2]; tile_x++)
+				grid->indices[grid->tile_start[tile_y * grid->tiles_x + tile_x]++] = (uint8_t)i;
+		}
+	}
+	for (int tile = num_tiles; tile > 0; tile--)
+		grid->tile_start[tile] = grid->tile_start[tile - 1];
+	grid->tile_start[0] = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Light at a point of a surface from the lights of its tile only. normal has
+// to be unit length. Each light falls off as (1 - d^2/r^2)^2, which reaches
+// zero at its radius without a square root.
+///////////////////////////////////////////////////////////////////////////////
+float light_grid_shade(const light_grid_t* grid, int tile, vec3_t position, vec3_t normal) {
+	float intensity = 0;
+	for (int i = grid->tile_start[tile]; i < grid->tile_start[tile + 1]; i++) {
+		const local_light_t* light = &grid->lights[grid->indices[i]];
+
+		vec3_t to_light;
+		vec3_sub_ref(&to_light, &light->position, &position);
+		float distance_squared = vec3_dot_ref(&to_light, &to_light);
+		float radius_squared = light->radius * light->radius;
+		if (distance_squared >= radius_squared || distance_squared == 0)
+			continue;
+
+		float facing = vec3_dot_ref(&normal, &to_light);
+		if (facing <= 0)
+			continue;
+
+		float inverse_distance = rsqrt_fast(distance_squared);
+		float falloff = 1 - distance_squared / radius_squared;
+		float contribution = light->intensity * falloff * falloff * facing * inverse_distance;
+
+		if (light->type == light_spot) {
+			float cos_angle = -vec3_dot_ref(&to_light, &light->direction) * inverse_distance;
+			if (cos_angle <= light->cos_outer)
+				continue;
+			if (cos_angle < light->cos_inner)
+				contribution *= (cos_angle - light->cos_outer) / (light->cos_inner - light->cos_outer);
+		}
+		intensity += contribution;
+	}
+	return intensity;
+}
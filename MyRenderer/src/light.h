@@ -2,14 +2,68 @@
 #define LIGHT_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "vector.h"
+#include "matrix.h"
+
+#define MAX_LIGHTS 256      // local lights per context, so a light index fits a byte
+#define LIGHT_TILE_SIZE 32  // pixels on a side of the screen tiles lights are binned to
 
 typedef struct {
 	vec3_t direction;
 } light_t;
 
-extern light_t light;
+typedef enum {
+	light_point, // shines all around
+	light_spot   // shines in a cone around its direction
+} local_light_type_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// A light with a position in the world. Its intensity falls off smoothly to
+// nothing at radius, so it only touches the pixels inside that sphere.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	local_light_type_t type;
+	vec3_t position;
+	float radius;
+	float intensity;
+	vec3_t direction; // spot only, unit vector down the middle of the cone
+	float cos_inner;  // spot only, full intensity inside this angle
+	float cos_outer;  // spot only, none outside this angle
+} local_light_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// The lights of one frame binned to screen tiles: the lights touching tile t
+// are lights[indices[tile_start[t]]] to lights[indices[tile_start[t + 1] - 1]],
+// in the order they were added.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+	int max_tiles;    // tiles the buffers were made for, the grid never grows past them
+	int num_lights;
+	local_light_t lights[MAX_LIGHTS];
+	int* tile_start;  // tiles_x * tiles_y + 1 entries
+	uint8_t* indices; // room for every light in every tile
+} light_grid_t;
+
+local_light_t light_make_point(vec3_t position, float radius, float intensity);
+local_light_t light_make_spot(vec3_t position, vec3_t direction, float radius, float intensity, float inner_angle, float outer_angle);
+
+bool light_grid_init(light_grid_t* grid, int width, int height);
+bool light_grid_resize(light_grid_t* grid, int width, int height);
+void light_grid_free(light_grid_t* grid);
+void light_grid_build(light_grid_t* grid, const local_light_t* lights, int num_lights, const mat4_t* proj_matrix, vec3_t camera_position);
+float light_grid_shade(const light_grid_t* grid, int tile, vec3_t position, vec3_t normal);
+
+static inline int light_grid_tile(const light_grid_t* grid, int x, int y) {
+	return (y / LIGHT_TILE_SIZE) * grid->tiles_x + x / LIGHT_TILE_SIZE;
+}
 
-uint32_t light_apply_intensity(uint32_t original_color, float percentage_factor);
+static inline bool light_grid_tile_empty(const light_grid_t* grid, int tile) {
+	return grid->tile_start[tile] == grid->tile_start[tile + 1];
+}
 
 #endif
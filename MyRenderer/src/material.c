@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <string.h>
+#include "material.h"
+#include "array.h"
+
+material_t* materials = NULL;
+
+// Drop the trailing newline and spaces of a line read by fgets
+static void trim_line(char* line) {
+    size_t length = strlen(line);
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' ' || line[length - 1] == '\t'))
+        line[--length] = '\0';
+}
+
+// A color component of a library in [0, 1] as a byte, out of range values clamped
+static uint32_t color_channel(float component) {
+    if (!(component > 0))
+        return 0;
+    if (component >= 1)
+        return 255;
+    return (uint32_t)(component * 255);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Read the materials of a .mtl library. Only the diffuse color (Kd) and the
+// diffuse map (map_Kd) are used, the map path is relative to the library.
+// A missing library is not an error, faces then keep the mesh texture.
+///////////////////////////////////////////////////////////////////////////////
+void load_mtl_file_data(const char* filename) {
+    FILE* file;
+    if (fopen_s(&file, filename, "r") != 0 || file == NULL) {
+        printf("Could not open the material library %s.\n", filename);
+        return;
+    }
+
+    const char* slash = strrchr(filename, '/');
+    int dir_length = slash ? (int)(slash - filename + 1) : 0;
+
+    char line[512];
+    material_t* material = NULL;
+
+    while (fgets(line, sizeof(line), file)) {
+        trim_line(line);
+        if (strncmp(line, "newmtl ", 7) == 0) {
+            material_t new_material = { .color = 0xFFFFFFFF, .texture = TEXTURE_NONE };
+            snprintf(new_material.name, sizeof(new_material.name), "%s", line + 7);
+            array_push(materials, new_material);
+            material = &materials[array_length(materials) - 1];
+        } else if (material != NULL && strncmp(line, "Kd ", 3) == 0) {
+            float r, g, b;
+            if (sscanf(line, "Kd %f %f %f", &r, &g, &b) == 3) {
+                // RGBA32 like the texels, red in the low byte
+                material->color = 0xFF000000 | color_channel(b) << 16 | color_channel(g) << 8 | color_channel(r);
+            }
+        } else if (material != NULL && strncmp(line, "map_Kd ", 7) == 0) {
+            char texture_path[512];
+            snprintf(texture_path, sizeof(texture_path), "%.*s%s", dir_length, filename, line + 7);
+            material->texture = load_png_texture_data(texture_path);
+        }
+    }
+    fclose(file);
+}
+
+// Index of the material with the given name, MATERIAL_NONE if it was never loaded
+int find_material(const char* name) {
+    int num_materials = array_length(materials);
+    for (int i = 0; i < num_materials; i++) {
+        if (strcmp(materials[i].name, name) == 0)
+            return i;
+    }
+    return MATERIAL_NONE;
+}
+
+void free_materials(void) {
+    array_free(materials);
+    materials = NULL;
+}
@@ -0,0 +1,21 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <stdint.h>
+#include "texture.h"
+
+#define MATERIAL_NONE (-1)
+
+typedef struct {
+    char name[64];
+    uint32_t color;           // diffuse color (Kd)
+    texture_handle_t texture; // diffuse map (map_Kd), TEXTURE_NONE when it has none
+} material_t;
+
+extern material_t* materials; // dynamic array of every material loaded so far
+
+void load_mtl_file_data(const char* filename);
+int find_material(const char* name);
+void free_materials(void);
+
+#endif
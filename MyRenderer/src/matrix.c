@@ -1,5 +1,6 @@
 #include <math.h>
 #include "matrix.h"
+#include "simd_math.h"
 
 mat4_t mat4_identity(void) {
 	mat4_t m = {{
@@ -82,20 +83,13 @@ mat4_t mat4_make_rotation_z(float angle) {
 
 vec4_t mat4_mul_vec4(mat4_t m, vec4_t v) {
     vec4_t result;
-    result.x = m.m[0][0] * v.x + m.m[0][1] * v.y + m.m[0][2] * v.z + m.m[0][3] * v.w;
-    result.y = m.m[1][0] * v.x + m.m[1][1] * v.y + m.m[1][2] * v.z + m.m[1][3] * v.w;
-    result.z = m.m[2][0] * v.x + m.m[2][1] * v.y + m.m[2][2] * v.z + m.m[2][3] * v.w;
-    result.w = m.m[3][0] * v.x + m.m[3][1] * v.y + m.m[3][2] * v.z + m.m[3][3] * v.w;
+    mat4_mul_vec4_ref(&result, &m, &v);
     return result;
 }
 
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b) {
     mat4_t m;
-    for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 4; j++) {
-            m.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
-        }
-    }
+    mat4_mul_mat4_ref(&m, &a, &b);
     return m;
 }
 
@@ -110,11 +104,76 @@ mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar) {
 }
 
 vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v) {
-    vec4_t result = mat4_mul_vec4(mat_proj, v);
-    if (result.w != 0.0) {
-        result.x /= result.w;
-        result.y /= result.w;
-        result.z /= result.w;
-    }
+    vec4_t result;
+    mat4_mul_vec4_project_ref(&result, &mat_proj, &v);
+    return result;
+}
+
+mat3x4_t mat3x4_identity(void) {
+	mat3x4_t m = {{
+		{1, 0, 0, 0},
+		{0, 1, 0, 0},
+		{0, 0, 1, 0}
+	}};
+	return m;
+}
+
+mat3x4_t mat3x4_make_world(vec3_t scale, quat_t orientation, vec3_t translation) {
+    // Translation * rotation * scale in one go, the rotation read off the unit quaternion:
+    // | (1-2(yy+zz))sx   2(xy-wz)sy      2(xz+wy)sz     tx |
+    // |  2(xy+wz)sx     (1-2(xx+zz))sy   2(yz-wx)sz     ty |
+    // |  2(xz-wy)sx      2(yz+wx)sy     (1-2(xx+yy))sz  tz |
+    float x = orientation.x, y = orientation.y, z = orientation.z, w = orientation.w;
+    mat3x4_t m;
+    m.m[0][0] = (1 - 2 * (y * y + z * z)) * scale.x;
+    m.m[0][1] = 2 * (x * y - w * z) * scale.y;
+    m.m[0][2] = 2 * (x * z + w * y) * scale.z;
+    m.m[0][3] = translation.x;
+    m.m[1][0] = 2 * (x * y + w * z) * scale.x;
+    m.m[1][1] = (1 - 2 * (x * x + z * z)) * scale.y;
+    m.m[1][2] = 2 * (y * z - w * x) * scale.z;
+    m.m[1][3] = translation.y;
+    m.m[2][0] = 2 * (x * z - w * y) * scale.x;
+    m.m[2][1] = 2 * (y * z + w * x) * scale.y;
+    m.m[2][2] = (1 - 2 * (x * x + y * y)) * scale.z;
+    m.m[2][3] = translation.z;
+    return m;
+}
+
+vec3_t mat3x4_mul_vec3(mat3x4_t m, vec3_t v) {
+    vec3_t result;
+    mat3x4_mul_vec3_ref(&result, &m, &v);
     return result;
-}
\ No newline at end of file
+}
+
+mat3x4_t mat3x4_mul_mat3x4(mat3x4_t a, mat3x4_t b) {
+    mat3x4_t m;
+    mat3x4_mul_mat3x4_ref(&m, &a, &b);
+    return m;
+}
+
+// Determinant of the linear part, negative when the transform mirrors
+float mat3x4_determinant(mat3x4_t m) {
+    return m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1])
+         - m.m[0][1] * (m.m[1][0] * m.m[2][2] - m.m[1][2] * m.m[2][0])
+         + m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+}
+
+mat3x4_t mat3x4_inverse(mat3x4_t m) {
+    // The linear part inverts to its adjugate over the determinant, the translation to -inverse * t
+    float inverse_determinant = 1 / mat3x4_determinant(m);
+    mat3x4_t r;
+    r.m[0][0] = (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1]) * inverse_determinant;
+    r.m[0][1] = (m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2]) * inverse_determinant;
+    r.m[0][2] = (m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1]) * inverse_determinant;
+    r.m[1][0] = (m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2]) * inverse_determinant;
+    r.m[1][1] = (m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0]) * inverse_determinant;
+    r.m[1][2] = (m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2]) * inverse_determinant;
+    r.m[2][0] = (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]) * inverse_determinant;
+    r.m[2][1] = (m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1]) * inverse_determinant;
+    r.m[2][2] = (m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0]) * inverse_determinant;
+    for (int i = 0; i < 3; i++) {
+        r.m[i][3] = -(r.m[i][0] * m.m[0][3] + r.m[i][1] * m.m[1][3] + r.m[i][2] * m.m[2][3]);
+    }
+    return r;
+}
@@ -7,6 +7,11 @@ typedef struct {
 	float m[4][4];
 } mat4_t;
 
+// Affine transform, the rows of a 4x4 matrix whose last row is 0 0 0 1
+typedef struct {
+	float m[3][4];
+} mat3x4_t;
+
 mat4_t mat4_identity(void);
 mat4_t mat4_make_scale(float sx, float sy, float sz);
 mat4_t mat4_make_translation(float tx, float ty, float tz);
@@ -18,4 +23,11 @@ vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v);
 vec4_t mat4_mul_vec4(mat4_t m, vec4_t v);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
 
+mat3x4_t mat3x4_identity(void);
+mat3x4_t mat3x4_make_world(vec3_t scale, quat_t orientation, vec3_t translation);
+vec3_t mat3x4_mul_vec3(mat3x4_t m, vec3_t v);
+mat3x4_t mat3x4_mul_mat3x4(mat3x4_t a, mat3x4_t b);
+float mat3x4_determinant(mat3x4_t m);
+mat3x4_t mat3x4_inverse(mat3x4_t m);
+
 #endif
@@ -1,16 +1,11 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "mesh.h"
+#include "material.h"
 #include "array.h"
+#include "simd_math.h"
 #include <string.h>
 
-mesh_t mesh = {
-    .vertices = NULL,
-    .faces = NULL,
-    .rotation = { 0, 0, 0 },
-    .scale = { 1.0, 1.0, 1.0 },
-    .translation = { 0, 0, 0 }
-};
-
 vec3_t cube_vertices[N_CUBE_VERTICES] = {
     {.x = -1, .y = -1, .z = -1 }, // 1
     {.x = -1, .y = 1, .z = -1 }, // 2
@@ -43,33 +38,154 @@ face_t cube_faces[N_CUBE_FACES] = {
     {.a = 6, .b = 1, .c = 4, .a_uv = { 0, 1 }, .b_uv = { 1, 0 }, .c_uv = { 1, 1 }, .color = 0xFFFFFFFF }
 };
 
-void load_cube_mesh_data(void) {
+void mesh_init(mesh_t* mesh) {
+    mesh->vertices = NULL;
+    mesh->faces = NULL;
+    mesh->normals = NULL;
+    mesh->orientation = quat_identity();
+    mesh->scale = (vec3_t){ 1.0, 1.0, 1.0 };
+    mesh->translation = (vec3_t){ 0, 0, 0 };
+    mesh->texture = TEXTURE_NONE;
+}
+
+void free_mesh(mesh_t* mesh) {
+    array_free(mesh->vertices);
+    array_free(mesh->faces);
+    array_free(mesh->normals);
+    mesh->vertices = NULL;
+    mesh->faces = NULL;
+    mesh->normals = NULL;
+}
+
+void load_cube_mesh_data(mesh_t* mesh) {
     for (int i = 0; i < N_CUBE_VERTICES; i++) {
         vec3_t cube_vertex = cube_vertices[i];
-        array_push(mesh.vertices, cube_vertex);
+        array_push(mesh->vertices, cube_vertex);
     }
     for (int i = 0; i < N_CUBE_FACES; i++) {
         face_t cube_face = cube_faces[i];
-        array_push(mesh.faces, cube_face);
+        cube_face.texture = TEXTURE_NONE;
+        array_push(mesh->faces, cube_face);
+    }
+    compute_face_normals(mesh);
+    compute_vertex_normals(mesh);
+}
+
+#define NORMALS_PER_BATCH 64
+
+///////////////////////////////////////////////////////////////////////////////
+// Work out the object space plane of every face once, after loading, so the
+// per frame culling is a single dot product. A batch of edges is crossed and
+// normalized at a time.
+///////////////////////////////////////////////////////////////////////////////
+void compute_face_normals(mesh_t* mesh) {
+    int num_faces = array_length(mesh->faces);
+    for (int first = 0; first < num_faces; first += NORMALS_PER_BATCH) {
+        int count = num_faces - first < NORMALS_PER_BATCH ? num_faces - first : NORMALS_PER_BATCH;
+        vec3_t edges_ab[NORMALS_PER_BATCH], edges_ac[NORMALS_PER_BATCH], normals[NORMALS_PER_BATCH];
+
+        for (int i = 0; i < count; i++) {
+            const face_t* face = &mesh->faces[first + i];
+            vec3_sub_ref(&edges_ab[i], &mesh->vertices[face->b - 1], &mesh->vertices[face->a - 1]);
+            vec3_sub_ref(&edges_ac[i], &mesh->vertices[face->c - 1], &mesh->vertices[face->a - 1]);
+        }
+        vec3_cross_batch(normals, edges_ab, edges_ac, count);
+        vec3_normalize_batch(normals, count);
+
+        for (int i = 0; i < count; i++) {
+            face_t* face = &mesh->faces[first + i];
+            face->normal = normals[i];
+            face->plane_offset = vec3_dot_ref(&normals[i], &mesh->vertices[face->a - 1]);
+        }
     }
 }
 
-void load_obj_file_data(char* filename) {
+///////////////////////////////////////////////////////////////////////////////
+// Give the faces the obj left without normals one normal per vertex, the sum
+// of the normals of the faces around it weighted by their area, so the
+// shading runs smoothly over the mesh. They are added after any obj normals.
+///////////////////////////////////////////////////////////////////////////////
+void compute_vertex_normals(mesh_t* mesh) {
+    int num_faces = array_length(mesh->faces);
+    int num_vertices = array_length(mesh->vertices);
+
+    bool missing = false;
+    for (int i = 0; i < num_faces && !missing; i++) {
+        const face_t* face = &mesh->faces[i];
+        missing = face->a_normal == 0 || face->b_normal == 0 || face->c_normal == 0;
+    }
+    if (!missing)
+        return;
+
+    vec3_t* smoothed = (vec3_t*)calloc(num_vertices, sizeof(vec3_t));
+    if (smoothed == NULL)
+        return;
+    for (int i = 0; i < num_faces; i++) {
+        const face_t* face = &mesh->faces[i];
+        vec3_t edge_ab, edge_ac, normal;
+        vec3_sub_ref(&edge_ab, &mesh->vertices[face->b - 1], &mesh->vertices[face->a - 1]);
+        vec3_sub_ref(&edge_ac, &mesh->vertices[face->c - 1], &mesh->vertices[face->a - 1]);
+        vec3_cross_ref(&normal, &edge_ab, &edge_ac); // twice the area long
+        vec3_add_ref(&smoothed[face->a - 1], &smoothed[face->a - 1], &normal);
+        vec3_add_ref(&smoothed[face->b - 1], &smoothed[face->b - 1], &normal);
+        vec3_add_ref(&smoothed[face->c - 1], &smoothed[face->c - 1], &normal);
+    }
+    vec3_normalize_batch(smoothed, num_vertices);
+
+    // Vertex i gets normal first + i
+    int first = array_length(mesh->normals) + 1;
+    for (int i = 0; i < num_vertices; i++)
+        array_push(mesh->normals, smoothed[i]);
+    free(smoothed);
+
+    for (int i = 0; i < num_faces; i++) {
+        face_t* face = &mesh->faces[i];
+        if (face->a_normal == 0 || face->b_normal == 0 || face->c_normal == 0) {
+            face->a_normal = first + face->a - 1;
+            face->b_normal = first + face->b - 1;
+            face->c_normal = first + face->c - 1;
+        }
+    }
+}
+
+void load_obj_file_data(mesh_t* mesh, char* filename) {
     FILE* file;
     if (fopen_s(&file, filename, "r") != 0) {
         printf("Could not open the file.\n");
     }
 
-    char line[100];
+    char line[256];
 
     tex2_t* texcoords = NULL;
+    int material = MATERIAL_NONE;
 
     while (fgets(line, sizeof(line), file)) {
+        // material library, relative to the obj file
+        if (strncmp(line, "mtllib ", 7) == 0) {
+            char name[128], path[512];
+            const char* slash = strrchr(filename, '/');
+            int dir_length = slash ? (int)(slash - filename + 1) : 0;
+            if (sscanf(line, "mtllib %127s", name) == 1) {
+                snprintf(path, sizeof(path), "%.*s%s", dir_length, filename, name);
+                load_mtl_file_data(path);
+            }
+        }
+        // material of the faces that follow
+        if (strncmp(line, "usemtl ", 7) == 0) {
+            char name[128];
+            material = sscanf(line, "usemtl %127s", name) == 1 ? find_material(name) : MATERIAL_NONE;
+        }
         // vertex information
         if (strncmp(line, "v ", 2) == 0) {
             vec3_t vertex;
             int result = sscanf(line, "v %f %f %f", &vertex.x, &vertex.y, &vertex.z);
-            array_push(mesh.vertices, vertex);
+            array_push(mesh->vertices, vertex);
+        }
+        // vertex normal information
+        if (strncmp(line, "vn ", 3) == 0) {
+            vec3_t normal;
+            int result = sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
+            array_push(mesh->normals, normal);
         }
         // texture coordiante information
         if (strncmp(line, "vt ", 3) == 0) {
@@ -87,18 +203,25 @@ void load_obj_file_data(char* filename) {
                 &vertex_indices[1], &texture_indices[1], &normal_indices[1],
                 &vertex_indices[2], &texture_indices[2], &normal_indices[2]
             );
+            bool has_normals = result == 9;
             face_t face = { 
                 .a = vertex_indices[0], 
                 .b = vertex_indices[1],
                 .c = vertex_indices[2],
+                .a_normal = has_normals ? normal_indices[0] : 0,
+                .b_normal = has_normals ? normal_indices[1] : 0,
+                .c_normal = has_normals ? normal_indices[2] : 0,
                 .a_uv = texcoords[texture_indices[0] - 1],
                 .b_uv = texcoords[texture_indices[1] - 1],
                 .c_uv = texcoords[texture_indices[2] - 1],
-                .color = 0xFFFFFFFF 
+                .color = material != MATERIAL_NONE ? materials[material].color : 0xFFFFFFFF,
+                .texture = material != MATERIAL_NONE ? materials[material].texture : TEXTURE_NONE
             };
-            array_push(mesh.faces, face);
+            array_push(mesh->faces, face);
         }
     }
     array_free(texcoords);
     fclose(file);
+    compute_face_normals(mesh);
+    compute_vertex_normals(mesh);
 }
\ No newline at end of file
@@ -13,14 +13,18 @@ extern face_t cube_faces[N_CUBE_FACES];
 typedef struct {
 	vec3_t* vertices;    // dynamic array of vertices
 	face_t* faces;	     // dynamic array of faces
-	vec3_t rotation;     // rotation with x, y, and z values
+	vec3_t* normals;     // dynamic array of vertex normals, from the obj or smoothed over the faces
+	quat_t orientation;  // rotation as a unit quaternion
 	vec3_t scale;	     // scale with x, y, and z values
 	vec3_t translation;  // translation with x, y, and z values
+	texture_handle_t texture; // texture of the faces without a material texture
 } mesh_t;
 
-extern mesh_t mesh;
-
-void load_cube_mesh_data(void);
-void load_obj_file_data(char* filename);
+void mesh_init(mesh_t* mesh);
+void free_mesh(mesh_t* mesh);
+void load_cube_mesh_data(mesh_t* mesh);
+void load_obj_file_data(mesh_t* mesh, char* filename);
+void compute_face_normals(mesh_t* mesh);
+void compute_vertex_normals(mesh_t* mesh);
 
 #endif
@@ -0,0 +1,113 @@
+#include <SDL.h>
+#include "pipeline.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// Three stage frame pipeline. The geometry thread fills triangle streams, the
+// raster thread draws them into framebuffers and the main thread presents.
+// Every stage goes through the slots in order, so frame N uses slot
+// N % PIPELINE_DEPTH for both its stream and its framebuffer. Each pair of
+// semaphores hands slots from one stage to the next; starting the free ones
+// at PIPELINE_DEPTH bounds how far ahead a stage can get, and so the latency.
+///////////////////////////////////////////////////////////////////////////////
+static SDL_sem* streams_free = NULL;
+static SDL_sem* streams_ready = NULL;
+static SDL_sem* frames_free = NULL;
+static SDL_sem* frames_ready = NULL;
+
+static SDL_Thread* geometry_thread = NULL;
+static SDL_Thread* raster_thread = NULL;
+static SDL_atomic_t running;
+
+static pipeline_stage_t geometry_stage = NULL;
+static pipeline_stage_t raster_stage = NULL;
+
+static int frames_presented = 0;
+
+// data points to the stage the thread runs
+static int geometry_run(void* data) {
+	pipeline_stage_t stage = *(const pipeline_stage_t*)data;
+	for (int frame = 0; ; frame++) {
+		SDL_SemWait(streams_free);
+		if (!SDL_AtomicGet(&running))
+			break;
+		stage(frame % PIPELINE_DEPTH);
+		SDL_SemPost(streams_ready);
+	}
+	return 0;
+}
+
+static int raster_run(void* data) {
+	pipeline_stage_t stage = *(const pipeline_stage_t*)data;
+	for (int frame = 0; ; frame++) {
+		SDL_SemWait(streams_ready);
+		SDL_SemWait(frames_free);
+		if (!SDL_AtomicGet(&running))
+			break;
+		stage(frame % PIPELINE_DEPTH);
+		SDL_SemPost(streams_free);
+		SDL_SemPost(frames_ready);
+	}
+	return 0;
+}
+
+static void destroy_semaphores(void) {
+	SDL_DestroySemaphore(streams_free);
+	SDL_DestroySemaphore(streams_ready);
+	SDL_DestroySemaphore(frames_free);
+	SDL_DestroySemaphore(frames_ready);
+	streams_free = streams_ready = frames_free = frames_ready = NULL;
+}
+
+bool pipeline_start(pipeline_stage_t geometry, pipeline_stage_t raster) {
+	geometry_stage = geometry;
+	raster_stage = raster;
+	frames_presented = 0;
+
+	streams_free = SDL_CreateSemaphore(PIPELINE_DEPTH);
+	streams_ready = SDL_CreateSemaphore(0);
+	frames_free = SDL_CreateSemaphore(PIPELINE_DEPTH);
+	frames_ready = SDL_CreateSemaphore(0);
+	if (!streams_free || !streams_ready || !frames_free || !frames_ready) {
+		destroy_semaphores();
+		return false;
+	}
+
+	SDL_AtomicSet(&running, 1);
+	geometry_thread = SDL_CreateThread(geometry_run, "geometry", &geometry_stage);
+	raster_thread = SDL_CreateThread(raster_run, "raster", &raster_stage);
+	if (geometry_thread == NULL || raster_thread == NULL) {
+		pipeline_stop();
+		return false;
+	}
+	return true;
+}
+
+// Wait for the next frame in order to be drawn and return its slot for presenting
+int pipeline_acquire_frame(void) {
+	SDL_SemWait(frames_ready);
+	return frames_presented % PIPELINE_DEPTH;
+}
+
+// Give the framebuffer of the frame just presented back to the raster stage
+void pipeline_release_frame(void) {
+	frames_presented++;
+	SDL_SemPost(frames_free);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stop both threads. Posting every semaphore wakes a stage wherever it waits,
+// and it sees the pipeline is no longer running before touching a slot.
+///////////////////////////////////////////////////////////////////////////////
+void pipeline_stop(void) {
+	SDL_AtomicSet(&running, 0);
+	SDL_SemPost(streams_free);
+	SDL_SemPost(streams_ready);
+	SDL_SemPost(frames_free);
+
+	if (geometry_thread != NULL)
+		SDL_WaitThread(geometry_thread, NULL);
+	if (raster_thread != NULL)
+		SDL_WaitThread(raster_thread, NULL);
+	geometry_thread = raster_thread = NULL;
+	destroy_semaphores();
+}
@@ -0,0 +1,16 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdbool.h>
+
+#define PIPELINE_DEPTH 2 // frames each stage may run ahead of the next one
+
+// A stage works on the triangle stream and framebuffer of one slot
+typedef void (*pipeline_stage_t)(int slot);
+
+bool pipeline_start(pipeline_stage_t geometry, pipeline_stage_t raster);
+int pipeline_acquire_frame(void);
+void pipeline_release_frame(void);
+void pipeline_stop(void);
+
+#endif
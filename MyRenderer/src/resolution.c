@@ -0,0 +1,36 @@
+#include <math.h>
+#include "resolution.h"
+
+void resolution_init(resolution_controller_t* controller, float budget, float min_scale) {
+	controller->budget = budget;
+	controller->min_scale = min_scale > 1 ? 1 : min_scale;
+	controller->scale = 1;
+	controller->frame_time = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Take the milliseconds the last frame took at the current scale and return
+// the scale to draw the next one at
+///////////////////////////////////////////////////////////////////////////////
+float resolution_update(resolution_controller_t* controller, float frame_time) {
+	if (!(frame_time > 0) || !(controller->budget > 0))
+		return controller->scale;
+
+	if (controller->frame_time == 0)
+		controller->frame_time = frame_time;
+	else
+		controller->frame_time += (frame_time - controller->frame_time) * RESOLUTION_SMOOTHING;
+
+	float ratio = controller->budget / controller->frame_time;
+	if (fabsf(ratio - 1) <= RESOLUTION_DEAD_BAND)
+		return controller->scale;
+
+	float target = controller->scale * sqrtf(ratio);
+	float scale = controller->scale + (target - controller->scale) * RESOLUTION_GAIN;
+	if (scale > 1)
+		scale = 1;
+	if (scale < controller->min_scale)
+		scale = controller->min_scale;
+	controller->scale = scale;
+	return scale;
+}
@@ -0,0 +1,26 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#define RESOLUTION_SMOOTHING 0.3f // weight of the newest frame time in the running average
+#define RESOLUTION_DEAD_BAND 0.1f // frame times within this fraction of the budget leave the scale alone
+#define RESOLUTION_GAIN 0.1f      // fraction of the way to the scale that would meet the budget taken per frame
+
+///////////////////////////////////////////////////////////////////////////////
+// Picks the resolution scale frames are drawn at so they take about budget
+// milliseconds each. The time to draw a frame goes roughly with its pixels,
+// the square of the scale, so the scale that meets the budget is the current
+// one times the square root of budget over the time taken. The controller
+// only moves part of the way there, and not at all while the average frame
+// time is near the budget, so a noisy frame doesn't make it hunt.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	float budget;     // milliseconds a frame should take
+	float min_scale;  // never draws at less than this fraction of the width and height
+	float scale;      // the scale to draw the next frame at
+	float frame_time; // running average of the milliseconds frames took, 0 before the first
+} resolution_controller_t;
+
+void resolution_init(resolution_controller_t* controller, float budget, float min_scale);
+float resolution_update(resolution_controller_t* controller, float frame_time);
+
+#endif
@@ -0,0 +1,260 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "shadow.h"
+#include "job.h"
+#include "simd_math.h"
+
+#define SHADOW_ROWS_PER_BAND 32 // rows of a map a thread draws at once
+#define SHADOW_BIAS_TEXELS 1.5f // how far, in texels, a surface may be behind its own map depth
+#define SHADOW_MAX_SLOPE 8.0f   // steepest slope the bias grows with, past about 83 degrees the light barely lands anyway
+#define SHADOW_NEAR_DEPTH 0.1f  // where the first cascade starts at the nearest
+#define SHADOW_SPLIT_BLEND 0.5f // cascade splits halfway between even and logarithmic
+
+bool shadow_init(shadow_t* shadow, int num_cascades) {
+	memset(shadow, 0, sizeof(shadow_t));
+	if (num_cascades < 1)
+		num_cascades = 1;
+	if (num_cascades > MAX_SHADOW_CASCADES)
+		num_cascades = MAX_SHADOW_CASCADES;
+	shadow->num_cascades = num_cascades;
+	for (int i = 0; i < num_cascades; i++) {
+		shadow->cascades[i].map = framebuffer_create(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, framebuffer_tiled);
+		if (shadow->cascades[i].map == NULL) {
+			shadow_free(shadow);
+			return false;
+		}
+	}
+	return true;
+}
+
+void shadow_free(shadow_t* shadow) {
+	for (int i = 0; i < shadow->num_cascades; i++)
+		framebuffer_destroy(shadow->cascades[i].map);
+	free(shadow->map_vertices);
+	memset(shadow, 0, sizeof(shadow_t));
+}
+
+// Whether the maps were drawn for this very scene, and need not be drawn again
+static bool shadow_is_current(const shadow_t* shadow, const shadow_scene_t* scene, vec3_t light_direction) {
+	return shadow->drawn &&
+		shadow->faces == scene->faces &&
+		shadow->num_faces == scene->num_faces &&
+		memcmp(&shadow->light_direction, &light_direction, sizeof(vec3_t)) == 0 &&
+		memcmp(&shadow->world_matrix, &scene->world_matrix, sizeof(mat3x4_t)) == 0 &&
+		memcmp(&shadow->camera_position, &scene->camera_position, sizeof(vec3_t)) == 0;
+}
+
+// A sphere around points, centered on their bounding box
+static void bounding_sphere(const vec3_t* points, int count, vec3_t* center, float* radius) {
+	vec3_t min = points[0], max = points[0];
+	for (int i = 1; i < count; i++) {
+		min.x = points[i].x < min.x ? points[i].x : min.x;
+		min.y = points[i].y < min.y ? points[i].y : min.y;
+		min.z = points[i].z < min.z ? points[i].z : min.z;
+		max.x = points[i].x > max.x ? points[i].x : max.x;
+		max.y = points[i].y > max.y ? points[i].y : max.y;
+		max.z = points[i].z > max.z ? points[i].z : max.z;
+	}
+	*center = (vec3_t){ (min.x + max.x) / 2, (min.y + max.y) / 2, (min.z + max.z) / 2 };
+
+	float radius_squared = 0;
+	for (int i = 0; i < count; i++) {
+		vec3_t offset;
+		vec3_sub_ref(&offset, &points[i], center);
+		float distance_squared = vec3_dot_ref(&offset, &offset);
+		radius_squared = distance_squared > radius_squared ? distance_squared : radius_squared;
+	}
+	*radius = sqrtf(radius_squared);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Point a cascade's map at a sphere, looking down the light. x and y span the
+// sphere across the map, the depth spans the scene's sphere so that casters
+// between the light and the cascade's slice still land in the map.
+///////////////////////////////////////////////////////////////////////////////
+static void fit_cascade(shadow_cascade_t* cascade, vec3_t right, vec3_t up, vec3_t light_direction, vec3_t center, float radius, vec3_t scene_center, float scene_radius) {
+	float scale = SHADOW_MAP_SIZE / (2 * radius);
+	float depth_scale = 1 / (2 * scene_radius);
+	mat3x4_t* m = &cascade->light_matrix;
+
+	m->m[0][0] = right.x * scale;
+	m->m[0][1] = right.y * scale;
+	m->m[0][2] = right.z * scale;
+	m->m[0][3] = -vec3_dot_ref(&right, &center) * scale + SHADOW_MAP_SIZE / 2;
+	m->m[1][0] = up.x * scale;
+	m->m[1][1] = up.y * scale;
+	m->m[1][2] = up.z * scale;
+	m->m[1][3] = -vec3_dot_ref(&up, &center) * scale + SHADOW_MAP_SIZE / 2;
+	m->m[2][0] = light_direction.x * depth_scale;
+	m->m[2][1] = light_direction.y * depth_scale;
+	m->m[2][2] = light_direction.z * depth_scale;
+	m->m[2][3] = (scene_radius - vec3_dot_ref(&light_direction, &scene_center)) * depth_scale;
+
+	// A texel is 2r/size across, shadow_visibility scales this by the slope of the surface
+	cascade->depth_bias = SHADOW_BIAS_TEXELS * (2 * radius / SHADOW_MAP_SIZE) * depth_scale;
+}
+
+typedef struct {
+	const shadow_t* shadow;
+	framebuffer_t* map;
+	const face_t* faces;
+	int num_faces;
+} shadow_job_t;
+
+// Draw the depth of every face into the bands of map rows [begin, end)
+static void draw_shadow_bands(void* data, int begin, int end) {
+	shadow_job_t* job = (shadow_job_t*)data;
+	const vec3_t* vertices = job->shadow->map_vertices;
+
+	for (int band_index = begin; band_index < end; band_index++) {
+		framebuffer_t band = framebuffer_rows(job->map, band_index * SHADOW_ROWS_PER_BAND, (band_index + 1) * SHADOW_ROWS_PER_BAND);
+		for (int i = 0; i < job->num_faces; i++) {
+			const vec3_t* a = &vertices[job->faces[i].a - 1];
+			const vec3_t* b = &vertices[job->faces[i].b - 1];
+			const vec3_t* c = &vertices[job->faces[i].c - 1];
+			draw_depth_triangle(&band, a->x, a->y, a->z, b->x, b->y, b->z, c->x, c->y, c->z);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the shadow maps for a scene, unless they were drawn for the same one
+// already. Returns whether they were drawn.
+///////////////////////////////////////////////////////////////////////////////
+bool shadow_update(shadow_t* shadow, const shadow_scene_t* scene) {
+	vec3_t light_direction = scene->light_direction;
+	vec3_normalize_ref(&light_direction);
+	if (shadow_is_current(shadow, scene, light_direction) || scene->num_vertices == 0)
+		return false;
+
+	vec3_t* map_vertices = (vec3_t*)realloc(shadow->map_vertices, sizeof(vec3_t) * scene->num_vertices);
+	if (map_vertices == NULL)
+		return false;
+	shadow->map_vertices = map_vertices;
+
+	// Axes of the maps, square to the light
+	vec3_t helper = fabsf(light_direction.y) < 0.99f ? (vec3_t){ 0, 1, 0 } : (vec3_t){ 1, 0, 0 };
+	vec3_t right, up;
+	vec3_cross_ref(&right, &helper, &light_direction);
+	vec3_normalize_ref(&right);
+	vec3_cross_ref(&up, &light_direction, &right);
+
+	// The scene's bounds, and the view depths it spans, camera looking down +z
+	for (int i = 0; i < scene->num_vertices; i++)
+		vec3_from_vec4_ref(&map_vertices[i], &scene->world_vertices[i]);
+	vec3_t scene_center;
+	float scene_radius;
+	bounding_sphere(map_vertices, scene->num_vertices, &scene_center, &scene_radius);
+	if (scene_radius <= 0)
+		scene_radius = 1;
+	float near_depth = scene_center.z - scene_radius - scene->camera_position.z;
+	float far_depth = scene_center.z + scene_radius - scene->camera_position.z;
+	if (near_depth < SHADOW_NEAR_DEPTH)
+		near_depth = SHADOW_NEAR_DEPTH;
+	if (far_depth < near_depth)
+		far_depth = near_depth;
+
+	for (int i = 0; i < shadow->num_cascades; i++) {
+		shadow_cascade_t* cascade = &shadow->cascades[i];
+		if (shadow->num_cascades == 1) {
+			cascade->far_depth = INFINITY;
+			fit_cascade(cascade, right, up, light_direction, scene_center, scene_radius, scene_center, scene_radius);
+			continue;
+		}
+
+		// The slice of the view between two split depths, each blended from an even and a logarithmic split
+		float split[2];
+		for (int end = 0; end < 2; end++) {
+			float fraction = (float)(i + end) / shadow->num_cascades;
+			float even = near_depth + (far_depth - near_depth) * fraction;
+			float logarithmic = near_depth * powf(far_depth / near_depth, fraction);
+			split[end] = even + (logarithmic - even) * SHADOW_SPLIT_BLEND;
+		}
+		cascade->far_depth = i == shadow->num_cascades - 1 ? INFINITY : split[1];
+
+		// Fit the corners of the slice, the screen spans depth/m[0][0] and depth/m[1][1] either way
+		vec3_t corners[8];
+		for (int corner = 0; corner < 8; corner++) {
+			float depth = split[corner >> 2];
+			corners[corner] = (vec3_t){
+				scene->camera_position.x + (corner & 1 ? 1 : -1) * depth / scene->proj_matrix->m[0][0],
+				scene->camera_position.y + (corner & 2 ? 1 : -1) * depth / scene->proj_matrix->m[1][1],
+				scene->camera_position.z + depth
+			};
+		}
+		vec3_t center;
+		float radius;
+		bounding_sphere(corners, 8, &center, &radius);
+		if (radius > scene_radius) {
+			center = scene_center;
+			radius = scene_radius;
+		}
+		fit_cascade(cascade, right, up, light_direction, center, radius, scene_center, scene_radius);
+	}
+
+	for (int i = 0; i < shadow->num_cascades; i++) {
+		shadow_cascade_t* cascade = &shadow->cascades[i];
+		for (int v = 0; v < scene->num_vertices; v++) {
+			vec3_t world;
+			vec3_from_vec4_ref(&world, &scene->world_vertices[v]);
+			mat3x4_mul_vec3_ref(&map_vertices[v], &cascade->light_matrix, &world);
+		}
+
+		framebuffer_clear_depth(cascade->map, 1.0f);
+		shadow_job_t job = { shadow, cascade->map, scene->faces, scene->num_faces };
+		parallel_for(draw_shadow_bands, &job, (SHADOW_MAP_SIZE + SHADOW_ROWS_PER_BAND - 1) / SHADOW_ROWS_PER_BAND, 1);
+	}
+
+	shadow->drawn = true;
+	shadow->light_direction = light_direction;
+	shadow->world_matrix = scene->world_matrix;
+	shadow->camera_position = scene->camera_position;
+	shadow->faces = scene->faces;
+	shadow->num_faces = scene->num_faces;
+	return true;
+}
+
+// 1 when the texel (x,y) of a map does not hide the depth, 0 when it does
+static inline float shadow_texel_lit(const framebuffer_t* map, int x, int y, float depth) {
+	if (x < 0 || y < 0 || x >= map->width || y >= map->height)
+		return 1.0f;
+	return depth <= map->depth[framebuffer_offset(map, x, y)] ? 1.0f : 0.0f;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// How much of the directional light reaches a point of the world, from 0 in
+// full shadow to 1. light_cosine is the cosine between the surface normal and
+// the light: a surface at a slant to it drifts in depth across a texel by the
+// tangent of the angle, and the bias grows along. The four texels around the
+// point are compared and blended, so shadow edges come out smooth.
+///////////////////////////////////////////////////////////////////////////////
+float shadow_visibility(const shadow_t* shadow, vec3_t position, float view_depth, float light_cosine) {
+	int index = 0;
+	while (index < shadow->num_cascades - 1 && view_depth >= shadow->cascades[index].far_depth)
+		index++;
+	const shadow_cascade_t* cascade = &shadow->cascades[index];
+
+	vec3_t point;
+	mat3x4_mul_vec3_ref(&point, &cascade->light_matrix, &position);
+	float slope = light_cosine > 0 ? sqrtf(1 - light_cosine * light_cosine) / light_cosine : SHADOW_MAX_SLOPE;
+	if (!(slope < SHADOW_MAX_SLOPE))
+		slope = SHADOW_MAX_SLOPE;
+	float depth = point.z - cascade->depth_bias * (1 + slope);
+
+	// Texel centers are half a texel in
+	float x = point.x - 0.5f;
+	float y = point.y - 0.5f;
+	float floor_x = floorf(x);
+	float floor_y = floorf(y);
+	if (floor_x < -1 || floor_y < -1 || floor_x >= SHADOW_MAP_SIZE || floor_y >= SHADOW_MAP_SIZE)
+		return 1.0f;
+	int x0 = (int)floor_x;
+	int y0 = (int)floor_y;
+	float tx = x - floor_x;
+	float ty = y - floor_y;
+
+	float top = shadow_texel_lit(cascade->map, x0, y0, depth) * (1 - tx) + shadow_texel_lit(cascade->map, x0 + 1, y0, depth) * tx;
+	float bottom = shadow_texel_lit(cascade->map, x0, y0 + 1, depth) * (1 - tx) + shadow_texel_lit(cascade->map, x0 + 1, y0 + 1, depth) * tx;
+	return top * (1 - ty) + bottom * ty;
+}
@@ -0,0 +1,57 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <stdbool.h>
+#include "vector.h"
+#include "matrix.h"
+#include "framebuffer.h"
+#include "triangle.h"
+
+#define SHADOW_MAP_SIZE 1024
+#define MAX_SHADOW_CASCADES 4
+
+typedef struct {
+	mat3x4_t light_matrix; // world to the map: x and y in pixels, z the depth from the light in [0, 1]
+	float far_depth;       // view depth where the next cascade takes over
+	float depth_bias;      // depth a surface square to the light may sit behind the map and still be lit
+	framebuffer_t* map;    // drawn depth only, its colors are never touched
+} shadow_cascade_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadow maps of the directional light. One cascade covers the whole mesh,
+// more split the view depth it spans into slices, each with its own map, so
+// the texels close to the camera stay small however far the mesh reaches.
+// The maps are only drawn again when what they were drawn for changes.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct shadow_t {
+	int num_cascades;
+	shadow_cascade_t cascades[MAX_SHADOW_CASCADES];
+	vec3_t* map_vertices; // scratch for the vertices of the cascade being drawn
+
+	// What the maps were drawn for
+	bool drawn;
+	vec3_t light_direction;
+	mat3x4_t world_matrix;
+	vec3_t camera_position;
+	const face_t* faces;
+	int num_faces;
+} shadow_t;
+
+// The world the shadows are cast in: a mesh already moved to world space, a light and a camera
+typedef struct {
+	const face_t* faces;
+	int num_faces;
+	const vec4_t* world_vertices;
+	int num_vertices;
+	mat3x4_t world_matrix;
+	vec3_t light_direction;
+	vec3_t camera_position;
+	const mat4_t* proj_matrix;
+} shadow_scene_t;
+
+bool shadow_init(shadow_t* shadow, int num_cascades);
+void shadow_free(shadow_t* shadow);
+bool shadow_update(shadow_t* shadow, const shadow_scene_t* scene);
+float shadow_visibility(const shadow_t* shadow, vec3_t position, float view_depth, float light_cosine);
+
+#endif
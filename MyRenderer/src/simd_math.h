@@ -0,0 +1,340 @@
+#ifndef SIMD_MATH_H
+#define SIMD_MATH_H
+
+#include <math.h>
+#include "vector.h"
+#include "matrix.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_MATH_USE_SSE2
+#endif
+
+////////////////////////////////////////////////////////////
+// Inline math. The _ref functions take their operands by
+// pointer and write through out, so hot loops get them
+// inlined without copying structs around. They do the same
+// operations in the same order as the functions of vector.c
+// and matrix.c, which are now wrappers around them, so
+// results match bit for bit. The _fast and batch functions
+// trade the last bits of precision for speed.
+////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////
+// Vector 2D
+////////////////////////////////////////////////////////////
+static inline void vec2_add_ref(vec2_t* out, const vec2_t* a, const vec2_t* b) {
+	out->x = a->x + b->x;
+	out->y = a->y + b->y;
+}
+
+static inline void vec2_sub_ref(vec2_t* out, const vec2_t* a, const vec2_t* b) {
+	out->x = a->x - b->x;
+	out->y = a->y - b->y;
+}
+
+static inline float vec2_dot_ref(const vec2_t* a, const vec2_t* b) {
+	return (a->x * b->x) + (a->y * b->y);
+}
+
+////////////////////////////////////////////////////////////
+// Vector 3D
+////////////////////////////////////////////////////////////
+static inline void vec3_add_ref(vec3_t* out, const vec3_t* a, const vec3_t* b) {
+	out->x = a->x + b->x;
+	out->y = a->y + b->y;
+	out->z = a->z + b->z;
+}
+
+static inline void vec3_sub_ref(vec3_t* out, const vec3_t* a, const vec3_t* b) {
+	out->x = a->x - b->x;
+	out->y = a->y - b->y;
+	out->z = a->z - b->z;
+}
+
+static inline void vec3_mul_ref(vec3_t* out, const vec3_t* v, float factor) {
+	out->x = v->x * factor;
+	out->y = v->y * factor;
+	out->z = v->z * factor;
+}
+
+static inline float vec3_dot_ref(const vec3_t* a, const vec3_t* b) {
+	return (a->x * b->x) + (a->y * b->y) + (a->z * b->z);
+}
+
+// out must not be a or b
+static inline void vec3_cross_ref(vec3_t* out, const vec3_t* a, const vec3_t* b) {
+	out->x = a->y * b->z - a->z * b->y;
+	out->y = a->z * b->x - a->x * b->z;
+	out->z = a->x * b->y - a->y * b->x;
+}
+
+static inline float vec3_length_ref(const vec3_t* v) {
+	return sqrtf(v->x * v->x + v->y * v->y + v->z * v->z);
+}
+
+static inline void vec3_normalize_ref(vec3_t* v) {
+	float length = vec3_length_ref(v);
+	v->x /= length;
+	v->y /= length;
+	v->z /= length;
+}
+
+// 1/sqrt(x) from the hardware estimate refined by one Newton-Raphson step, about 22 bits
+static inline float rsqrt_fast(float x) {
+#ifdef SIMD_MATH_USE_SSE2
+	float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+	return r * (1.5f - 0.5f * x * r * r);
+#else
+	return 1.0f / sqrtf(x);
+#endif
+}
+
+// Normalize with a multiply by the fast reciprocal square root instead of three divides
+static inline void vec3_normalize_fast(vec3_t* v) {
+	float inverse_length = rsqrt_fast(v->x * v->x + v->y * v->y + v->z * v->z);
+	v->x *= inverse_length;
+	v->y *= inverse_length;
+	v->z *= inverse_length;
+}
+
+////////////////////////////////////////////////////////////
+// Vector conversion
+////////////////////////////////////////////////////////////
+static inline void vec4_from_vec3_ref(vec4_t* out, const vec3_t* v) {
+	out->x = v->x;
+	out->y = v->y;
+	out->z = v->z;
+	out->w = 1.0f;
+}
+
+static inline void vec3_from_vec4_ref(vec3_t* out, const vec4_t* v) {
+	out->x = v->x;
+	out->y = v->y;
+	out->z = v->z;
+}
+
+static inline void vec2_from_vec4_ref(vec2_t* out, const vec4_t* v) {
+	out->x = v->x;
+	out->y = v->y;
+}
+
+////////////////////////////////////////////////////////////
+// Quaternion
+////////////////////////////////////////////////////////////
+
+// out must not be a or b
+static inline void quat_mul_ref(quat_t* out, const quat_t* a, const quat_t* b) {
+	out->x = a->w * b->x + a->x * b->w + a->y * b->z - a->z * b->y;
+	out->y = a->w * b->y - a->x * b->z + a->y * b->w + a->z * b->x;
+	out->z = a->w * b->z + a->x * b->y - a->y * b->x + a->z * b->w;
+	out->w = a->w * b->w - a->x * b->x - a->y * b->y - a->z * b->z;
+}
+
+////////////////////////////////////////////////////////////
+// Matrix 4x4
+////////////////////////////////////////////////////////////
+#ifdef SIMD_MATH_USE_SSE2
+// The columns of m, so m * v is a sum of columns scaled by the components of v
+static inline void mat4_load_columns(const mat4_t* m, __m128 columns[4]) {
+	columns[0] = _mm_loadu_ps(m->m[0]);
+	columns[1] = _mm_loadu_ps(m->m[1]);
+	columns[2] = _mm_loadu_ps(m->m[2]);
+	columns[3] = _mm_loadu_ps(m->m[3]);
+	_MM_TRANSPOSE4_PS(columns[0], columns[1], columns[2], columns[3]);
+}
+
+// Adds in the same order as the scalar rows: ((c0 x + c1 y) + c2 z) + c3 w
+static inline __m128 mat4_columns_mul(const __m128 columns[4], __m128 x, __m128 y, __m128 z, __m128 w) {
+	__m128 sum = _mm_add_ps(_mm_mul_ps(columns[0], x), _mm_mul_ps(columns[1], y));
+	sum = _mm_add_ps(sum, _mm_mul_ps(columns[2], z));
+	return _mm_add_ps(sum, _mm_mul_ps(columns[3], w));
+}
+#endif
+
+static inline void mat4_mul_vec4_ref(vec4_t* out, const mat4_t* m, const vec4_t* v) {
+#ifdef SIMD_MATH_USE_SSE2
+	__m128 columns[4];
+	mat4_load_columns(m, columns);
+	_mm_storeu_ps(&out->x, mat4_columns_mul(columns,
+		_mm_set1_ps(v->x), _mm_set1_ps(v->y), _mm_set1_ps(v->z), _mm_set1_ps(v->w)));
+#else
+	vec4_t result;
+	result.x = m->m[0][0] * v->x + m->m[0][1] * v->y + m->m[0][2] * v->z + m->m[0][3] * v->w;
+	result.y = m->m[1][0] * v->x + m->m[1][1] * v->y + m->m[1][2] * v->z + m->m[1][3] * v->w;
+	result.z = m->m[2][0] * v->x + m->m[2][1] * v->y + m->m[2][2] * v->z + m->m[2][3] * v->w;
+	result.w = m->m[3][0] * v->x + m->m[3][1] * v->y + m->m[3][2] * v->z + m->m[3][3] * v->w;
+	*out = result;
+#endif
+}
+
+// out may be a or b
+static inline void mat4_mul_mat4_ref(mat4_t* out, const mat4_t* a, const mat4_t* b) {
+	mat4_t m;
+#ifdef SIMD_MATH_USE_SSE2
+	// Row i of the product is the rows of b scaled by row i of a
+	__m128 b_rows[4] = { _mm_loadu_ps(b->m[0]), _mm_loadu_ps(b->m[1]), _mm_loadu_ps(b->m[2]), _mm_loadu_ps(b->m[3]) };
+	for (int i = 0; i < 4; i++) {
+		_mm_storeu_ps(m.m[i], mat4_columns_mul(b_rows,
+			_mm_set1_ps(a->m[i][0]), _mm_set1_ps(a->m[i][1]), _mm_set1_ps(a->m[i][2]), _mm_set1_ps(a->m[i][3])));
+	}
+#else
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < 4; j++) {
+			m.m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j] + a->m[i][3] * b->m[3][j];
+		}
+	}
+#endif
+	*out = m;
+}
+
+static inline void mat4_mul_vec4_project_ref(vec4_t* out, const mat4_t* mat_proj, const vec4_t* v) {
+	mat4_mul_vec4_ref(out, mat_proj, v);
+	if (out->w != 0.0) {
+		out->x /= out->w;
+		out->y /= out->w;
+		out->z /= out->w;
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Affine 3x4, the last row of 0 0 0 1 is left out, so a point
+// takes 9 multiplies and 9 adds and a product skips a quarter
+// of the 4x4 work
+////////////////////////////////////////////////////////////
+#ifdef SIMD_MATH_USE_SSE2
+static inline void mat3x4_load_columns(const mat3x4_t* m, __m128 columns[4]) {
+	columns[0] = _mm_loadu_ps(m->m[0]);
+	columns[1] = _mm_loadu_ps(m->m[1]);
+	columns[2] = _mm_loadu_ps(m->m[2]);
+	columns[3] = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+	_MM_TRANSPOSE4_PS(columns[0], columns[1], columns[2], columns[3]);
+}
+#endif
+
+static inline void mat3x4_mul_vec3_ref(vec3_t* out, const mat3x4_t* m, const vec3_t* v) {
+	vec3_t result;
+	result.x = m->m[0][0] * v->x + m->m[0][1] * v->y + m->m[0][2] * v->z + m->m[0][3];
+	result.y = m->m[1][0] * v->x + m->m[1][1] * v->y + m->m[1][2] * v->z + m->m[1][3];
+	result.z = m->m[2][0] * v->x + m->m[2][1] * v->y + m->m[2][2] * v->z + m->m[2][3];
+	*out = result;
+}
+
+// out = a * b, applying b first, out may be a or b
+static inline void mat3x4_mul_mat3x4_ref(mat3x4_t* out, const mat3x4_t* a, const mat3x4_t* b) {
+	mat3x4_t m;
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 3; j++) {
+			m.m[i][j] = a->m[i][0] * b->m[0][j] + a->m[i][1] * b->m[1][j] + a->m[i][2] * b->m[2][j];
+		}
+		m.m[i][3] = a->m[i][0] * b->m[0][3] + a->m[i][1] * b->m[1][3] + a->m[i][2] * b->m[2][3] + a->m[i][3];
+	}
+	*out = m;
+}
+
+////////////////////////////////////////////////////////////
+// Batches
+////////////////////////////////////////////////////////////
+
+// out[i] = m * (points[i], 1), the matrix is loaded once for all of them
+static inline void mat4_transform_points(const mat4_t* m, const vec3_t* points, vec4_t* out, int count) {
+#ifdef SIMD_MATH_USE_SSE2
+	__m128 columns[4];
+	mat4_load_columns(m, columns);
+	const __m128 one = _mm_set1_ps(1.0f);
+	for (int i = 0; i < count; i++) {
+		_mm_storeu_ps(&out[i].x, mat4_columns_mul(columns,
+			_mm_set1_ps(points[i].x), _mm_set1_ps(points[i].y), _mm_set1_ps(points[i].z), one));
+	}
+#else
+	for (int i = 0; i < count; i++) {
+		vec4_t point;
+		vec4_from_vec3_ref(&point, &points[i]);
+		mat4_mul_vec4_ref(&out[i], m, &point);
+	}
+#endif
+}
+
+// out[i] = m * (points[i], 1) with w = 1, ready for the projection matrix
+static inline void mat3x4_transform_points(const mat3x4_t* m, const vec3_t* points, vec4_t* out, int count) {
+#ifdef SIMD_MATH_USE_SSE2
+	__m128 columns[4];
+	mat3x4_load_columns(m, columns);
+	for (int i = 0; i < count; i++) {
+		// The translation column is added as it is, lane 3 only gets the 1 of w
+		__m128 sum = _mm_add_ps(_mm_mul_ps(columns[0], _mm_set1_ps(points[i].x)), _mm_mul_ps(columns[1], _mm_set1_ps(points[i].y)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(columns[2], _mm_set1_ps(points[i].z)));
+		_mm_storeu_ps(&out[i].x, _mm_add_ps(sum, columns[3]));
+	}
+#else
+	for (int i = 0; i < count; i++) {
+		vec3_t point;
+		mat3x4_mul_vec3_ref(&point, m, &points[i]);
+		vec4_from_vec3_ref(&out[i], &point);
+	}
+#endif
+}
+
+#ifdef SIMD_MATH_USE_SSE2
+// Four vec3 as one register per component
+static inline void vec3_load_x4(const vec3_t* v, __m128* x, __m128* y, __m128* z) {
+	*x = _mm_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x);
+	*y = _mm_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y);
+	*z = _mm_setr_ps(v[0].z, v[1].z, v[2].z, v[3].z);
+}
+
+static inline void vec3_store_x4(vec3_t* v, __m128 x, __m128 y, __m128 z) {
+	float xs[4], ys[4], zs[4];
+	_mm_storeu_ps(xs, x);
+	_mm_storeu_ps(ys, y);
+	_mm_storeu_ps(zs, z);
+	for (int i = 0; i < 4; i++) {
+		v[i].x = xs[i];
+		v[i].y = ys[i];
+		v[i].z = zs[i];
+	}
+}
+#endif
+
+// vec3_normalize_fast on count vectors, four at a time. Zero vectors stay zero.
+static inline void vec3_normalize_batch(vec3_t* v, int count) {
+	int i = 0;
+#ifdef SIMD_MATH_USE_SSE2
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 three_halves = _mm_set1_ps(1.5f);
+	for (; i + 4 <= count; i += 4) {
+		__m128 x, y, z;
+		vec3_load_x4(&v[i], &x, &y, &z);
+		__m128 length_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+		__m128 r = _mm_rsqrt_ps(length_squared);
+		r = _mm_mul_ps(r, _mm_sub_ps(three_halves, _mm_mul_ps(_mm_mul_ps(half, length_squared), _mm_mul_ps(r, r))));
+		r = _mm_and_ps(r, _mm_cmpgt_ps(length_squared, _mm_setzero_ps())); // 1/sqrt(0) is infinite
+		vec3_store_x4(&v[i], _mm_mul_ps(x, r), _mm_mul_ps(y, r), _mm_mul_ps(z, r));
+	}
+#endif
+	for (; i < count; i++) {
+		if (v[i].x != 0 || v[i].y != 0 || v[i].z != 0)
+			vec3_normalize_fast(&v[i]);
+	}
+}
+
+// out[i] = a[i] x b[i], four at a time
+static inline void vec3_cross_batch(vec3_t* out, const vec3_t* a, const vec3_t* b, int count) {
+	int i = 0;
+#ifdef SIMD_MATH_USE_SSE2
+	for (; i + 4 <= count; i += 4) {
+		__m128 ax, ay, az, bx, by, bz;
+		vec3_load_x4(&a[i], &ax, &ay, &az);
+		vec3_load_x4(&b[i], &bx, &by, &bz);
+		vec3_store_x4(&out[i],
+			_mm_sub_ps(_mm_mul_ps(ay, bz), _mm_mul_ps(az, by)),
+			_mm_sub_ps(_mm_mul_ps(az, bx), _mm_mul_ps(ax, bz)),
+			_mm_sub_ps(_mm_mul_ps(ax, by), _mm_mul_ps(ay, bx)));
+	}
+#endif
+	for (; i < count; i++) {
+		vec3_cross_ref(&out[i], &a[i], &b[i]);
+	}
+}
+
+#endif
@@ -1,22 +1,605 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include "texture.h"
+#include "texture_cache.h"
+#include "virtual_texture.h"
 #include "upng.h"
+#include "color.h"
 
-int texture_width = 64;
-int texture_height = 64;
+texture_layout_t texture_layout = layout_morton;
+bool texture_compact = false;
 
-extern upng_t* png_texture = NULL;
-extern uint32_t* mesh_texture = NULL;
+///////////////////////////////////////////////////////////////////////////////
+// Texture registry. Every png is loaded once, meshes and faces refer to it by
+// handle, the index of its slot.
+///////////////////////////////////////////////////////////////////////////////
+static texture_t textures[MAX_TEXTURES];
+static char texture_filenames[MAX_TEXTURES][256];
+static int num_textures = 0;
 
-void load_png_texture_data(char* filename) {
-	png_texture = upng_new_from_file(filename);
+static bool is_power_of_two(int n) {
+	return n > 0 && (n & (n - 1)) == 0;
+}
+
+static int log2_int(int n) {
+	int result = 0;
+	while ((1 << (result + 1)) <= n)
+		result++;
+	return result;
+}
+
+// Spread the low 16 bits of n so they land on the even bit positions
+static uint32_t morton_spread(uint32_t n) {
+	n &= 0x0000FFFF;
+	n = (n | (n << 8)) & 0x00FF00FF;
+	n = (n | (n << 4)) & 0x0F0F0F0F;
+	n = (n | (n << 2)) & 0x33333333;
+	n = (n | (n << 1)) & 0x55555555;
+	return n;
+}
+
+int mip_level_num_texels(const mip_level_t* mip) {
+	if (mip->layout == layout_tiled) {
+		// Partial tiles at the right and bottom borders are padded to 4x4
+		return ((mip->width + 3) / 4) * ((mip->height + 3) / 4) * 16;
+	}
+	return mip->width * mip->height;
+}
+
+int texel_format_size(texel_format_t format) {
+	return format == texel_rgba8888 ? sizeof(uint32_t) : sizeof(uint16_t);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the addressing tables of a mip level, without touching its texels.
+// Every layout is separable, the texel of (x,y) lives at offset_x[x] + offset_y[y],
+// so sampling is two table lookups no matter how the texels are arranged.
+///////////////////////////////////////////////////////////////////////////////
+bool mip_level_init_addressing(mip_level_t* mip, int width, int height, texture_layout_t layout) {
+	mip->width = width;
+	mip->height = height;
+	mip->texels = NULL;
+	mip->format = texel_rgba8888;
+	mip->mapped = false;
+	mip->pow2 = is_power_of_two(width) && is_power_of_two(height);
+	mip->mask_x = width - 1;
+	mip->mask_y = height - 1;
+
+	// The Z-order curve only covers power-of-two sizes
+	if (layout == layout_morton && !mip->pow2)
+		layout = layout_linear;
+	mip->layout = layout;
+
+	mip->offset_x = (uint32_t*)malloc(sizeof(uint32_t) * width);
+	mip->offset_y = (uint32_t*)malloc(sizeof(uint32_t) * height);
+	if (mip->offset_x == NULL || mip->offset_y == NULL) {
+		free(mip->offset_x);
+		free(mip->offset_y);
+		mip->offset_x = NULL;
+		mip->offset_y = NULL;
+		return false;
+	}
+
+	int tiles_per_row = (width + 3) / 4;
+	int min_log2 = log2_int(width < height ? width : height);
+	uint32_t low_mask = (1u << min_log2) - 1;
+
+	for (int x = 0; x < width; x++) {
+		switch (layout) {
+		case layout_tiled:
+			mip->offset_x[x] = (x >> 2) * 16 + (x & 3);
+			break;
+		case layout_morton:
+			// Interleave the shared low bits, the leftover high bits of the longer side go on top
+			mip->offset_x[x] = morton_spread(x & low_mask) | ((x >> min_log2) << (2 * min_log2));
+			break;
+		default:
+			mip->offset_x[x] = x;
+			break;
+		}
+	}
+	for (int y = 0; y < height; y++) {
+		switch (layout) {
+		case layout_tiled:
+			mip->offset_y[y] = (y >> 2) * tiles_per_row * 16 + (y & 3) * 4;
+			break;
+		case layout_morton:
+			mip->offset_y[y] = (morton_spread(y & low_mask) << 1) | ((y >> min_log2) << (2 * min_log2));
+			break;
+		default:
+			mip->offset_y[y] = y * width;
+			break;
+		}
+	}
+	return true;
+}
+
+static void mip_level_free(mip_level_t* mip) {
+	// Texels that live in a mapped cache file are released with the mapping
+	if (!mip->mapped)
+		free(mip->texels);
+	free(mip->offset_x);
+	free(mip->offset_y);
+	mip->texels = NULL;
+	mip->offset_x = NULL;
+	mip->offset_y = NULL;
+}
+
+// Allocate the texels of a mip level along with its addressing tables
+static bool mip_level_init(mip_level_t* mip, int width, int height, texture_layout_t layout, texel_format_t format) {
+	if (!mip_level_init_addressing(mip, width, height, layout))
+		return false;
+
+	mip->format = format;
+	mip->texels = malloc(texel_format_size(format) * mip_level_num_texels(mip));
+	if (mip->texels == NULL) {
+		mip_level_free(mip);
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Texel access in the renderer's color format (RGBA32, red in the low byte).
+// 16-bit texels are packed on write and widened again on read, replicating the
+// top bits of each channel so full intensity stays 0xFF.
+///////////////////////////////////////////////////////////////////////////////
+static uint16_t color_to_rgb565(uint32_t color) {
+	uint32_t r = color & 0xFF, g = (color >> 8) & 0xFF, b = (color >> 16) & 0xFF;
+	return (uint16_t)(((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255));
+}
+
+static uint32_t rgb565_to_color(uint16_t texel) {
+	uint32_t r = (texel >> 11) & 0x1F, g = (texel >> 5) & 0x3F, b = texel & 0x1F;
+	r = (r << 3) | (r >> 2);
+	g = (g << 2) | (g >> 4);
+	b = (b << 3) | (b >> 2);
+	return 0xFF000000 | (b << 16) | (g << 8) | r;
+}
+
+static uint16_t color_to_rgba4444(uint32_t color) {
+	uint16_t texel = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		texel |= (uint16_t)((((color >> shift) & 0xFF) * 15 + 127) / 255) << (shift / 2);
+	}
+	return texel;
+}
+
+static uint32_t rgba4444_to_color(uint16_t texel) {
+	uint32_t color = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		color |= (((uint32_t)texel >> (shift / 2)) & 0xF) * 0x11 << shift;
+	}
+	return color;
+}
+
+static uint32_t mip_read(const mip_level_t* mip, int x, int y) {
+	uint32_t offset = mip->offset_x[x] + mip->offset_y[y];
+	switch (mip->format) {
+	case texel_rgb565:
+		return rgb565_to_color(((const uint16_t*)mip->texels)[offset]);
+	case texel_rgba4444:
+		return rgba4444_to_color(((const uint16_t*)mip->texels)[offset]);
+	default:
+		return ((const uint32_t*)mip->texels)[offset];
+	}
+}
+
+static void mip_write(mip_level_t* mip, int x, int y, uint32_t color) {
+	uint32_t offset = mip->offset_x[x] + mip->offset_y[y];
+	switch (mip->format) {
+	case texel_rgb565:
+		((uint16_t*)mip->texels)[offset] = color_to_rgb565(color);
+		break;
+	case texel_rgba4444:
+		((uint16_t*)mip->texels)[offset] = color_to_rgba4444(color);
+		break;
+	default:
+		((uint32_t*)mip->texels)[offset] = color;
+		break;
+	}
+}
+
+static unsigned char* read_file_bytes(const char* filename, long* size) {
+	FILE* file;
+	if (fopen_s(&file, filename, "rb") != 0 || file == NULL) {
+		printf("Could not open the file %s.\n", filename);
+		return NULL;
+	}
+
+	fseek(file, 0, SEEK_END);
+	*size = ftell(file);
+	rewind(file);
+
+	unsigned char* bytes = (unsigned char*)malloc(*size);
+	if (bytes != NULL && fread(bytes, 1, *size, file) != (size_t)*size) {
+		free(bytes);
+		bytes = NULL;
+	}
+	fclose(file);
+	return bytes;
+}
+
+typedef struct {
+	mip_level_t* mip;
+	int components; // 1 gray, 2 gray + alpha, 3 RGB, 4 RGBA
+	int bitdepth;   // bits per channel, 1 to 16
+} png_row_sink_t;
+
+// Channel sample number index of a png scanline, scaled to 8 bits
+static uint32_t png_row_sample(const unsigned char* row, int index, int bitdepth) {
+	if (bitdepth == 8)
+		return row[index];
+	if (bitdepth == 16)
+		return row[index * 2]; // big-endian, the high byte is the 8-bit value
+	int bit = index * bitdepth;
+	int max = (1 << bitdepth) - 1;
+	int value = (row[bit >> 3] >> (8 - bitdepth - (bit & 7))) & max;
+	return (uint32_t)(value * 255 / max);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Color of pixel x of a png scanline, normalized to the renderer's RGBA32
+// color format whatever the png format
+///////////////////////////////////////////////////////////////////////////////
+uint32_t png_row_color(const unsigned char* row, int x, int components, int bitdepth) {
+	int index = x * components;
+	uint32_t r, g, b, a = 0xFF;
+	if (components <= 2) {
+		r = g = b = png_row_sample(row, index, bitdepth);
+		if (components == 2)
+			a = png_row_sample(row, index + 1, bitdepth);
+	} else {
+		r = png_row_sample(row, index, bitdepth);
+		g = png_row_sample(row, index + 1, bitdepth);
+		b = png_row_sample(row, index + 2, bitdepth);
+		if (components == 4)
+			a = png_row_sample(row, index + 3, bitdepth);
+	}
+	return (a << 24) | (b << 16) | (g << 8) | r;
+}
+
+// Row sink of the png decoder, each scanline is normalized while it is stored
+static void store_png_row(void* user, unsigned y, const unsigned char* row, unsigned long size) {
+	png_row_sink_t* sink = (png_row_sink_t*)user;
+	mip_level_t* mip = sink->mip;
+	if (size * 8 < (unsigned long)mip->width * sink->components * sink->bitdepth)
+		return;
+
+	for (int x = 0; x < mip->width; x++) {
+		mip_write(mip, x, (int)y, png_row_color(row, x, sink->components, sink->bitdepth));
+	}
+}
+
+// Compact storage keeps 5/6/5 bits of color when every texel is opaque,
+// and trades color depth for 4 bits of alpha otherwise
+static texel_format_t compact_texel_format(const mip_level_t* mip) {
+	for (int y = 0; y < mip->height; y++) {
+		for (int x = 0; x < mip->width; x++) {
+			if ((mip_read(mip, x, y) >> 24) != 0xFF)
+				return texel_rgba4444;
+		}
+	}
+	return texel_rgb565;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Open the page file of a large png as a virtual texture, building the file
+// first when it is missing or stale. The mip levels of the texture only get
+// their sizes, which is all the level of detail computation needs.
+///////////////////////////////////////////////////////////////////////////////
+static bool load_virtual_texture(texture_t* texture, const char* filename, upng_t* png, uint64_t source_hash) {
+	char pages_path[512];
+	snprintf(pages_path, sizeof(pages_path), "%s.vtpages", filename);
+
+	virtual_texture_t* virtual_texture = virtual_texture_open(pages_path, source_hash);
+	if (virtual_texture == NULL && virtual_texture_build(pages_path, source_hash, png))
+		virtual_texture = virtual_texture_open(pages_path, source_hash);
+	if (virtual_texture == NULL)
+		return false;
+
+	texture->virtual_texture = virtual_texture;
+	texture->num_mips = virtual_texture->num_mips;
+	for (int i = 0; i < texture->num_mips; i++) {
+		mip_level_t* mip = &texture->mips[i];
+		memset(mip, 0, sizeof(*mip));
+		mip->width = virtual_texture->mips[i].width;
+		mip->height = virtual_texture->mips[i].height;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Load a png into texture with the texture_layout storage mode and a full
+// mip chain. The png is decoded row by row into the first level, which the
+// texture owns along with the rest of the chain. Every level is built at 32
+// bits per texel and packed to 16 bits afterwards in texture_compact mode.
+// When a texture cache file built from the same png bytes exists next to it,
+// the levels are mapped straight from that file and the png is never decoded.
+// Pngs larger than virtual_texture_threshold become virtual textures instead.
+///////////////////////////////////////////////////////////////////////////////
+static bool load_png_texture(texture_t* texture, const char* filename) {
+	long size;
+	unsigned char* bytes = read_file_bytes(filename, &size);
+	if (bytes == NULL)
+		return false;
+
+	char cache_path[512];
+	snprintf(cache_path, sizeof(cache_path), "%s.texcache", filename);
+	uint64_t source_hash = texture_cache_hash(bytes, size);
+
+	upng_t* png_texture = upng_new_from_bytes(bytes, size);
 	if (png_texture != NULL)
 	{
-		upng_decode(png_texture);
-		if (upng_get_error(png_texture) == UPNG_EOK)
-		{
-			mesh_texture = (uint32_t*)upng_get_buffer(png_texture);
-			texture_width = upng_get_width(png_texture);
-			texture_height = upng_get_height(png_texture);
+		upng_header(png_texture);
+		int width = upng_get_width(png_texture);
+		int height = upng_get_height(png_texture);
+		if (upng_get_error(png_texture) == UPNG_EOK && (width > virtual_texture_threshold || height > virtual_texture_threshold)) {
+			bool loaded = load_virtual_texture(texture, filename, png_texture, source_hash);
+			upng_free(png_texture);
+			free(bytes);
+			return loaded;
+		}
+
+		if (texture_cache_enabled && texture_cache_load(texture, cache_path, source_hash, texture_layout, texture_compact)) {
+			upng_free(png_texture);
+			free(bytes);
+			return true;
+		}
+
+		png_row_sink_t sink = {
+			.mip = &texture->mips[0],
+			.components = upng_get_components(png_texture),
+			.bitdepth = upng_get_bitdepth(png_texture)
+		};
+
+		// Scanlines go straight from the decoder into level 0, the png is never
+		// held decoded in memory
+		if (upng_get_error(png_texture) == UPNG_EOK && upng_get_format(png_texture) != UPNG_BADFORMAT &&
+			mip_level_init(&texture->mips[0], width, height, texture_layout, texel_rgba8888)) {
+			if (upng_decode_rows(png_texture, store_png_row, &sink) == UPNG_EOK) {
+				texture->num_mips = 1;
+			} else {
+				mip_level_free(&texture->mips[0]);
+			}
+		}
+		upng_free(png_texture);
+	}
+	free(bytes);
+
+	if (texture->num_mips == 0)
+		return false;
+
+	texture_generate_mipmaps(texture);
+	if (texture_compact)
+		texture_set_format(texture, compact_texel_format(&texture->mips[0]));
+
+	if (texture_cache_enabled) {
+		texture_cache_store(texture, cache_path, source_hash, texture_layout, texture_compact);
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Register the texture of a png file, returning its handle. A file that is
+// already registered is not loaded again. Returns TEXTURE_NONE when the png
+// can not be loaded or the registry is full.
+///////////////////////////////////////////////////////////////////////////////
+texture_handle_t load_png_texture_data(const char* filename) {
+	for (int i = 0; i < num_textures; i++) {
+		if (strcmp(texture_filenames[i], filename) == 0)
+			return i;
+	}
+	if (num_textures == MAX_TEXTURES || strlen(filename) >= sizeof(texture_filenames[0]))
+		return TEXTURE_NONE;
+
+	texture_t* texture = &textures[num_textures];
+	texture->num_mips = 0;
+	texture->cache_mapping = NULL;
+	texture->virtual_texture = NULL;
+	if (!load_png_texture(texture, filename))
+		return TEXTURE_NONE;
+
+	snprintf(texture_filenames[num_textures], sizeof(texture_filenames[0]), "%s", filename);
+	return num_textures++;
+}
+
+texture_t* get_texture(texture_handle_t handle) {
+	if (handle < 0 || handle >= num_textures)
+		return NULL;
+	return &textures[handle];
+}
+
+int get_num_textures(void) {
+	return num_textures;
+}
+
+void free_textures(void) {
+	for (int i = 0; i < num_textures; i++) {
+		free_texture(&textures[i]);
+	}
+	num_textures = 0;
+	virtual_texture_shutdown();
+}
+
+// Average of four colors, each 8-bit channel separately, rounding to nearest
+uint32_t color_box_filter(uint32_t c00, uint32_t c01, uint32_t c10, uint32_t c11) {
+	return color_average(c00, c01, c10, c11);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the mip chain below mips[0] with a 2x2 box filter, down to 1x1.
+// Odd sizes clamp the second row/column, so every level is max(1, size / 2).
+// New levels use the same layout and format as the level they are filtered from.
+///////////////////////////////////////////////////////////////////////////////
+void texture_generate_mipmaps(texture_t* texture) {
+	while (texture->num_mips < MAX_MIP_LEVELS) {
+		mip_level_t* src = &texture->mips[texture->num_mips - 1];
+		if (src->width == 1 && src->height == 1)
+			break;
+
+		mip_level_t* dst = &texture->mips[texture->num_mips];
+		int width = src->width > 1 ? src->width / 2 : 1;
+		int height = src->height > 1 ? src->height / 2 : 1;
+		if (!mip_level_init(dst, width, height, src->layout, src->format))
+			break;
+
+		for (int y = 0; y < dst->height; y++) {
+			int y0 = y * 2;
+			int y1 = (y0 + 1 < src->height) ? y0 + 1 : y0;
+			for (int x = 0; x < dst->width; x++) {
+				int x0 = x * 2;
+				int x1 = (x0 + 1 < src->width) ? x0 + 1 : x0;
+
+				uint32_t result = color_box_filter(
+					mip_read(src, x0, y0), mip_read(src, x1, y0),
+					mip_read(src, x0, y1), mip_read(src, x1, y1)
+				);
+				mip_write(dst, x, y, result);
+			}
 		}
+		texture->num_mips++;
+	}
+}
+
+// Copy a mip level into a new layout and texel format
+static bool mip_level_convert(mip_level_t* mip, texture_layout_t layout, texel_format_t format) {
+	mip_level_t converted;
+	if (!mip_level_init(&converted, mip->width, mip->height, layout, format))
+		return false;
+
+	for (int y = 0; y < mip->height; y++) {
+		for (int x = 0; x < mip->width; x++) {
+			mip_write(&converted, x, y, mip_read(mip, x, y));
+		}
+	}
+	mip_level_free(mip);
+	*mip = converted;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Re-arrange the texels of every mip level into a different storage layout
+///////////////////////////////////////////////////////////////////////////////
+void texture_set_layout(texture_t* texture, texture_layout_t layout) {
+	for (int i = 0; i < texture->num_mips; i++) {
+		if (!mip_level_convert(&texture->mips[i], layout, texture->mips[i].format))
+			return;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Re-encode the texels of every mip level in a different texel format. Going
+// from 16 to 32 bits does not bring back the precision lost when packing.
+///////////////////////////////////////////////////////////////////////////////
+void texture_set_format(texture_t* texture, texel_format_t format) {
+	for (int i = 0; i < texture->num_mips; i++) {
+		if (!mip_level_convert(&texture->mips[i], texture->mips[i].layout, format))
+			return;
+	}
+}
+
+void free_texture(texture_t* texture) {
+	for (int i = 0; i < texture->num_mips; i++) {
+		mip_level_free(&texture->mips[i]);
+	}
+	texture->num_mips = 0;
+	texture_cache_release(texture);
+	if (texture->virtual_texture != NULL) {
+		virtual_texture_free(texture->virtual_texture);
+		texture->virtual_texture = NULL;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Level of detail for a whole triangle, from the ratio between the area it
+// covers in texel space (at mips[0]) and the area it covers on screen.
+// Each mip halves both sides, so the level is half the log2 of that ratio.
+///////////////////////////////////////////////////////////////////////////////
+float texture_triangle_lod(
+	const texture_t* texture,
+	float x0, float y0, float u0, float v0,
+	float x1, float y1, float u1, float v1,
+	float x2, float y2, float u2, float v2
+) {
+	if (texture->num_mips <= 1)
+		return 0;
+
+	float screen_area = fabsf((x1 - x0) * (y2 - y0) - (x2 - x0) * (y1 - y0));
+	float texel_area = fabsf((u1 - u0) * (v2 - v0) - (u2 - u0) * (v1 - v0));
+	texel_area *= (float)texture->mips[0].width * (float)texture->mips[0].height;
+
+	if (screen_area <= 0 || texel_area <= 0)
+		return 0;
+
+	float lod = 0.5f * log2f(texel_area / screen_area);
+	if (lod < 0) lod = 0;
+	if (lod > texture->num_mips - 1) lod = (float)(texture->num_mips - 1);
+	return lod;
+}
+
+static uint32_t mip_fetch_nearest(const mip_level_t* mip, float u, float v) {
+	int tex_x, tex_y;
+	if (mip->pow2) {
+		tex_x = (int)(u * mip->width) & mip->mask_x;
+		tex_y = (int)(v * mip->height) & mip->mask_y;
+	} else {
+		tex_x = abs((int)(u * mip->width)) % mip->width;
+		tex_y = abs((int)(v * mip->height)) % mip->height;
+	}
+	return mip_read(mip, tex_x, tex_y);
+}
+
+static uint32_t mip_fetch_bilinear(const mip_level_t* mip, float u, float v) {
+	float fx = u * mip->width - 0.5f;
+	float fy = v * mip->height - 0.5f;
+	float floor_x = floorf(fx);
+	float floor_y = floorf(fy);
+	uint32_t tx = (uint32_t)((fx - floor_x) * COLOR_ONE);
+	uint32_t ty = (uint32_t)((fy - floor_y) * COLOR_ONE);
+
+	// Wrap both neighbours so the filter repeats across texture borders
+	int x0, y0, x1, y1;
+	if (mip->pow2) {
+		x0 = (int)floor_x & mip->mask_x;
+		y0 = (int)floor_y & mip->mask_y;
+		x1 = (x0 + 1) & mip->mask_x;
+		y1 = (y0 + 1) & mip->mask_y;
+	} else {
+		x0 = (int)floor_x % mip->width;
+		y0 = (int)floor_y % mip->height;
+		if (x0 < 0) x0 += mip->width;
+		if (y0 < 0) y0 += mip->height;
+		x1 = (x0 + 1) % mip->width;
+		y1 = (y0 + 1) % mip->height;
+	}
+
+	return color_bilinear(mip_read(mip, x0, y0), mip_read(mip, x1, y0), mip_read(mip, x0, y1), mip_read(mip, x1, y1), tx, ty);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sample the texture at (u,v) with the given filter mode
+///////////////////////////////////////////////////////////////////////////////
+uint32_t texture_sample(const texture_t* texture, float u, float v, float lod, texture_filter_t filter) {
+	// Virtual textures are point sampled in the closest level that is resident
+	if (texture->virtual_texture != NULL)
+		return virtual_texture_sample(texture->virtual_texture, u, v, filter == filter_no_mip ? 0 : lod);
+
+	switch (filter) {
+	case filter_trilinear: {
+		int level = (int)lod;
+		int next_level = (level + 1 < texture->num_mips) ? level + 1 : level;
+		uint32_t t = (uint32_t)((lod - level) * COLOR_ONE);
+		uint32_t near_color = mip_fetch_bilinear(&texture->mips[level], u, v);
+		if (t == 0 || next_level == level)
+			return near_color;
+		return color_lerp(near_color, mip_fetch_bilinear(&texture->mips[next_level], u, v), t);
+	}
+	case filter_nearest_mip:
+		return mip_fetch_nearest(&texture->mips[(int)(lod + 0.5f)], u, v);
+	default:
+		return mip_fetch_nearest(&texture->mips[0], u, v);
 	}
-}
\ No newline at end of file
+}
@@ -2,19 +2,86 @@
 #define TEXTURE_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "upng.h"
 
+#define MAX_MIP_LEVELS 16
+#define MAX_TEXTURES 64
+#define TEXTURE_NONE (-1)
+
 typedef struct {
     float u;
     float v;
 } tex2_t;
 
-extern int texture_width;
-extern int texture_height;
+typedef enum {
+    layout_linear, // row-major
+    layout_tiled,  // 4x4 texel tiles, tiles stored row-major
+    layout_morton  // Z-order curve over the whole level
+} texture_layout_t;
+
+typedef enum {
+    texel_rgba8888, // 32 bits, the renderer's color format
+    texel_rgb565,   // 16 bits, compact storage of opaque textures
+    texel_rgba4444  // 16 bits, compact storage of textures with alpha
+} texel_format_t;
+
+typedef struct {
+    int width;
+    int height;
+    void* texels;
+    texel_format_t format;
+    texture_layout_t layout;
+    bool mapped;        // texels point into a mapped texture cache file
+    bool pow2;          // power-of-two sizes wrap with the masks, others with abs() and %
+    int mask_x;
+    int mask_y;
+    uint32_t* offset_x; // texel offset contributed by each column
+    uint32_t* offset_y; // texel offset contributed by each row
+} mip_level_t;
+
+struct virtual_texture_t;
+
+typedef struct {
+    mip_level_t mips[MAX_MIP_LEVELS]; // mips[0] is the full resolution image
+    int num_mips;
+    void* cache_mapping; // texture cache file backing mapped levels, if any
+    struct virtual_texture_t* virtual_texture; // pages of a texture too large to hold, the mips then only carry sizes
+} texture_t;
+
+// Index of a texture in the texture registry, TEXTURE_NONE for no texture
+typedef int texture_handle_t;
+
+typedef enum {
+    filter_no_mip,      // always sample the full resolution level
+    filter_nearest_mip, // pick the closest mip once per triangle (default)
+    filter_trilinear    // bilinear in the two closest mips, blended by the triangle's fractional LOD
+} texture_filter_t;
+
+extern texture_layout_t texture_layout;
+extern bool texture_compact; // store new textures at 16 bits per texel
+
+texture_handle_t load_png_texture_data(const char* filename);
+texture_t* get_texture(texture_handle_t handle);
+int get_num_textures(void);
+void free_textures(void);
+bool mip_level_init_addressing(mip_level_t* mip, int width, int height, texture_layout_t layout);
+int mip_level_num_texels(const mip_level_t* mip);
+int texel_format_size(texel_format_t format);
+void texture_generate_mipmaps(texture_t* texture);
+void texture_set_layout(texture_t* texture, texture_layout_t layout);
+void texture_set_format(texture_t* texture, texel_format_t format);
+void free_texture(texture_t* texture);
 
-extern upng_t* png_texture;
-extern uint32_t* mesh_texture;
+uint32_t png_row_color(const unsigned char* row, int x, int components, int bitdepth);
+uint32_t color_box_filter(uint32_t c00, uint32_t c01, uint32_t c10, uint32_t c11);
 
-void load_png_texture_data(char* filename);
+float texture_triangle_lod(
+    const texture_t* texture,
+    float x0, float y0, float u0, float v0,
+    float x1, float y1, float u1, float v1,
+    float x2, float y2, float u2, float v2
+);
+uint32_t texture_sample(const texture_t* texture, float u, float v, float lod, texture_filter_t filter);
 
 #endif
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "texture_cache.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// A texture cache file holds the decoded texels of every mip level, already in
+// their storage layout, behind a small header. Texel data of each level starts
+// on a 64-byte boundary so the mapped levels are cache-line aligned.
+///////////////////////////////////////////////////////////////////////////////
+#define TEXTURE_CACHE_MAGIC 0x5845544D // "MTEX"
+#define TEXTURE_CACHE_VERSION 2
+#define TEXTURE_CACHE_ALIGNMENT 64
+
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t offset;     // byte offset of the texels from the start of the file
+	uint32_t num_texels;
+} texture_cache_mip_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash; // hash of the png bytes the texels were decoded from
+	uint32_t layout;
+	uint32_t format;      // texel format shared by every level
+	uint32_t num_mips;
+	texture_cache_mip_t mips[MAX_MIP_LEVELS];
+} texture_cache_header_t;
+
+typedef struct {
+	const unsigned char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+} file_mapping_t;
+
+bool texture_cache_enabled = true;
+
+///////////////////////////////////////////////////////////////////////////////
+// 64-bit FNV-1a hash of the source file bytes
+///////////////////////////////////////////////////////////////////////////////
+uint64_t texture_cache_hash(const unsigned char* bytes, size_t size) {
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+static file_mapping_t* map_file(const char* path) {
+	file_mapping_t* mapping = (file_mapping_t*)malloc(sizeof(file_mapping_t));
+	if (mapping == NULL)
+		return NULL;
+
+#ifdef _WIN32
+	mapping->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mapping->file == INVALID_HANDLE_VALUE) {
+		free(mapping);
+		return NULL;
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(mapping->file, &size);
+	mapping->size = (size_t)size.QuadPart;
+	mapping->mapping = CreateFileMappingA(mapping->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	mapping->data = mapping->mapping ? (const unsigned char*)MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (mapping->data == NULL) {
+		if (mapping->mapping)
+			CloseHandle(mapping->mapping);
+		CloseHandle(mapping->file);
+		free(mapping);
+		return NULL;
+	}
+#else
+	mapping->fd = open(path, O_RDONLY);
+	if (mapping->fd < 0) {
+		free(mapping);
+		return NULL;
+	}
+	struct stat info;
+	fstat(mapping->fd, &info);
+	mapping->size = (size_t)info.st_size;
+	void* data = mapping->size > 0 ? mmap(NULL, mapping->size, PROT_READ, MAP_PRIVATE, mapping->fd, 0) : MAP_FAILED;
+	if (data == MAP_FAILED) {
+		close(mapping->fd);
+		free(mapping);
+		return NULL;
+	}
+	mapping->data = (const unsigned char*)data;
+#endif
+	return mapping;
+}
+
+static void unmap_file(file_mapping_t* mapping) {
+#ifdef _WIN32
+	UnmapViewOfFile(mapping->data);
+	CloseHandle(mapping->mapping);
+	CloseHandle(mapping->file);
+#else
+	munmap((void*)mapping->data, mapping->size);
+	close(mapping->fd);
+#endif
+	free(mapping);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Map a cache file and point the texture levels straight at its texels.
+// Returns false, leaving the texture untouched, when the file is missing, was
+// built from different png bytes or stores another layout or texel size.
+///////////////////////////////////////////////////////////////////////////////
+bool texture_cache_load(texture_t* texture, const char* cache_path, uint64_t source_hash, texture_layout_t layout, bool compact) {
+	file_mapping_t* mapping = map_file(cache_path);
+	if (mapping == NULL)
+		return false;
+
+	const texture_cache_header_t* header = (const texture_cache_header_t*)mapping->data;
+	if (mapping->size < sizeof(texture_cache_header_t) ||
+		header->magic != TEXTURE_CACHE_MAGIC ||
+		header->version != TEXTURE_CACHE_VERSION ||
+		header->source_hash != source_hash ||
+		header->layout != (uint32_t)layout ||
+		header->format > texel_rgba4444 ||
+		(header->format != texel_rgba8888) != compact ||
+		header->num_mips == 0 || header->num_mips > MAX_MIP_LEVELS) {
+		unmap_file(mapping);
+		return false;
+	}
+
+	int num_mips = 0;
+	for (uint32_t i = 0; i < header->num_mips; i++) {
+		const texture_cache_mip_t* entry = &header->mips[i];
+		mip_level_t* mip = &texture->mips[i];
+		if (!mip_level_init_addressing(mip, entry->width, entry->height, layout) ||
+			(uint32_t)mip_level_num_texels(mip) != entry->num_texels ||
+			(size_t)entry->offset + (size_t)entry->num_texels * texel_format_size(header->format) > mapping->size) {
+			break;
+		}
+		mip->texels = (void*)(mapping->data + entry->offset);
+		mip->format = (texel_format_t)header->format;
+		mip->mapped = true;
+		num_mips++;
+	}
+
+	if (num_mips != (int)header->num_mips) {
+		// A truncated or inconsistent file, drop whatever was set up and rebuild
+		for (int i = 0; i <= num_mips && i < MAX_MIP_LEVELS; i++) {
+			free(texture->mips[i].offset_x);
+			free(texture->mips[i].offset_y);
+			texture->mips[i].offset_x = NULL;
+			texture->mips[i].offset_y = NULL;
+			texture->mips[i].texels = NULL;
+		}
+		unmap_file(mapping);
+		return false;
+	}
+
+	texture->num_mips = num_mips;
+	texture->cache_mapping = mapping;
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write the decoded levels of a texture to a cache file for the next run
+///////////////////////////////////////////////////////////////////////////////
+void texture_cache_store(const texture_t* texture, const char* cache_path, uint64_t source_hash, texture_layout_t layout, bool compact) {
+	// Only whole textures in one texel format of the requested size can be stored
+	texel_format_t format = texture->mips[0].format;
+	for (int i = 0; i < texture->num_mips; i++) {
+		if (texture->mips[i].format != format)
+			return;
+	}
+	if ((format != texel_rgba8888) != compact)
+		return;
+
+	texture_cache_header_t header;
+	memset(&header, 0, sizeof(header));
+	header.magic = TEXTURE_CACHE_MAGIC;
+	header.version = TEXTURE_CACHE_VERSION;
+	header.source_hash = source_hash;
+	header.layout = (uint32_t)layout; // as requested, so lookups match even when a level fell back to linear
+	header.format = (uint32_t)format;
+	header.num_mips = texture->num_mips;
+
+	uint32_t offset = sizeof(header);
+	for (int i = 0; i < texture->num_mips; i++) {
+		offset = (offset + TEXTURE_CACHE_ALIGNMENT - 1) & ~(uint32_t)(TEXTURE_CACHE_ALIGNMENT - 1);
+		header.mips[i].width = texture->mips[i].width;
+		header.mips[i].height = texture->mips[i].height;
+		header.mips[i].offset = offset;
+		header.mips[i].num_texels = mip_level_num_texels(&texture->mips[i]);
+		offset += header.mips[i].num_texels * texel_format_size(format);
+	}
+
+	FILE* file;
+	if (fopen_s(&file, cache_path, "wb") != 0 || file == NULL)
+		return;
+
+	static const unsigned char padding[TEXTURE_CACHE_ALIGNMENT] = { 0 };
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	uint32_t position = sizeof(header);
+	for (int i = 0; ok && i < texture->num_mips; i++) {
+		size_t padding_size = header.mips[i].offset - position;
+		ok = fwrite(padding, 1, padding_size, file) == padding_size;
+		ok = ok && fwrite(texture->mips[i].texels, texel_format_size(format), header.mips[i].num_texels, file) == header.mips[i].num_texels;
+		position = header.mips[i].offset + header.mips[i].num_texels * texel_format_size(format);
+	}
+	fclose(file);
+
+	// Never leave a half written cache behind, it would only be rejected later
+	if (!ok)
+		remove(cache_path);
+}
+
+void texture_cache_release(texture_t* texture) {
+	if (texture->cache_mapping != NULL) {
+		unmap_file((file_mapping_t*)texture->cache_mapping);
+		texture->cache_mapping = NULL;
+	}
+}
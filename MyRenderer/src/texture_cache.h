@@ -0,0 +1,16 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "texture.h"
+
+extern bool texture_cache_enabled;
+
+uint64_t texture_cache_hash(const unsigned char* bytes, size_t size);
+bool texture_cache_load(texture_t* texture, const char* cache_path, uint64_t source_hash, texture_layout_t layout, bool compact);
+void texture_cache_store(const texture_t* texture, const char* cache_path, uint64_t source_hash, texture_layout_t layout, bool compact);
+void texture_cache_release(texture_t* texture);
+
+#endif
@@ -1,6 +1,10 @@
 #include "display.h"
 #include "swap.h"
 #include "triangle.h"
+#include "light.h"
+#include "shadow.h"
+#include "simd_math.h"
+#include "color.h"
 
 ///////////////////////////////////////////////////////////////////////////////
 // Return the barycentric weights alpha, beta, and gamma for point p
@@ -17,13 +21,14 @@
 //  (A)------------(C)
 //
 ///////////////////////////////////////////////////////////////////////////////
-vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
+static inline vec3_t barycentric_weights(const vec2_t* a, const vec2_t* b, const vec2_t* c, const vec2_t* p) {
     // Find the vectors between the vertices ABC and point p
-    vec2_t ac = vec2_sub(c, a);
-    vec2_t ab = vec2_sub(b, a);
-    vec2_t ap = vec2_sub(p, a);
-    vec2_t pc = vec2_sub(c, p);
-    vec2_t pb = vec2_sub(b, p);
+    vec2_t ac, ab, ap, pc, pb;
+    vec2_sub_ref(&ac, c, a);
+    vec2_sub_ref(&ab, b, a);
+    vec2_sub_ref(&ap, p, a);
+    vec2_sub_ref(&pc, c, p);
+    vec2_sub_ref(&pb, b, p);
 
     // Compute the area of the full parallegram/triangle ABC using 2D cross product
     float area_parallelogram_abc = (ac.x * ab.y - ac.y * ab.x); // || AC x AB ||
@@ -44,27 +49,154 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p) {
 ///////////////////////////////////////////////////////////////////////////////
 // Draw a triangle using three raw line calls
 ///////////////////////////////////////////////////////////////////////////////
-void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
-    draw_line(x0, y0, x1, y1, color);
-    draw_line(x1, y1, x2, y2, color);
-    draw_line(x2, y2, x0, y0, color);
+void draw_triangle(framebuffer_t* target, int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color) {
+    draw_line(target, x0, y0, x1, y1, color);
+    draw_line(target, x1, y1, x2, y2, color);
+    draw_line(target, x2, y2, x0, y0, color);
+}
+
+// Narrow the rows [*y_start, *y_end] down to the ones the target draws
+static void clip_rows(const framebuffer_t* target, int* y_start, int* y_end) {
+    if (*y_start < target->clip_top)
+        *y_start = target->clip_top;
+    if (*y_end > target->clip_bottom - 1)
+        *y_end = target->clip_bottom - 1;
+}
+
+#define SHADING_CACHE_BLOCKS 2048 // 2x2 block columns, wider targets shade every pixel past them
+
+///////////////////////////////////////////////////////////////////////////////
+// Variable rate shading. Where the target's shading rate is coarse, the first
+// pixel a triangle draws in a block is shaded and every other one it draws
+// there takes the same result, while depth is still tested per pixel. The
+// cache keeps one result per column of blocks, for the row of blocks the
+// spans are in.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int row[SHADING_CACHE_BLOCKS];       // the top pixel row of the block the value is for, -1 for none
+    uint32_t value[SHADING_CACHE_BLOCKS];
+    int first;                           // the columns [first, last] are the only ones reset for the triangle
+    int last;
+} shading_cache_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Forget what an earlier triangle shaded in the columns between the vertices
+// x0, x1 and x2. A block is found by the column of its left edge, so the
+// first column is that of the coarsest block holding the leftmost pixel.
+///////////////////////////////////////////////////////////////////////////////
+static void shading_cache_reset(shading_cache_t* cache, int x0, int x1, int x2) {
+    int x_min = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+    int x_max = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+    cache->first = x_min < 0 ? 0 : (x_min >> FRAMEBUFFER_MAX_SHADING_RATE) << (FRAMEBUFFER_MAX_SHADING_RATE - 1);
+    cache->last = x_max / 2 < SHADING_CACHE_BLOCKS ? x_max / 2 : SHADING_CACHE_BLOCKS - 1;
+    for (int column = cache->first; column <= cache->last; column++)
+        cache->row[column] = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Where the shading of the block holding pixel (x,y) is kept, or NULL when the
+// pixel is shaded on its own. shaded tells whether the value is there already,
+// if not the caller shades the pixel and stores it for the rest of the block.
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t* shading_block(const framebuffer_t* target, shading_cache_t* cache, int x, int y, bool* shaded) {
+    int rate = framebuffer_shading_rate(target, x, y);
+    if (rate == 0)
+        return NULL;
+    int mask = (1 << rate) - 1;
+    int column = (x & ~mask) / 2;
+    if (column < cache->first || column > cache->last)
+        return NULL;
+    int row = y & ~mask;
+    *shaded = cache->row[column] == row;
+    cache->row[column] = row;
+    return &cache->value[column];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The light at a point of the triangle with the given barycentric weights and
+// interpolated 1/w, in pixel (x,y). Shadows dim the interpolated directional
+// light, and the local lights of the pixel's tile, if it has any, are added,
+// both at the interpolated position (and normal).
+///////////////////////////////////////////////////////////////////////////////
+static float light_triangle_point(
+    int x, int y, vec3_t weights, float interpolated_reciprocal_w,
+    vec4_t point_a, vec4_t point_b, vec4_t point_c,
+    vec3_t intensities, const triangle_surface_t* surface, const pixel_lighting_t* lighting
+) {
+    float alpha = weights.x;
+    float beta = weights.y;
+    float gamma = weights.z;
+
+    // Interpolate the light of the vertices like the texture coordinates, with a factor of 1/w
+    float interpolated_intensity = (intensities.x / point_a.w) * alpha + (intensities.y / point_b.w) * beta + (intensities.z / point_c.w) * gamma;
+    interpolated_intensity /= interpolated_reciprocal_w;
+
+    const light_grid_t* lights = lighting != NULL ? lighting->lights : NULL;
+    const shadow_t* shadow = lighting != NULL ? lighting->shadow : NULL;
+    int tile = lights != NULL ? light_grid_tile(lights, x, y) : 0;
+    bool lit_locally = lights != NULL && !light_grid_tile_empty(lights, tile);
+
+    // Perspective correct weights for the world surface
+    float weight_a = 0, weight_b = 0, weight_c = 0;
+    vec3_t position = { 0, 0, 0 };
+    if (shadow != NULL || lit_locally) {
+        weight_a = alpha / point_a.w / interpolated_reciprocal_w;
+        weight_b = beta / point_b.w / interpolated_reciprocal_w;
+        weight_c = gamma / point_c.w / interpolated_reciprocal_w;
+        position = (vec3_t){
+            surface->points[0].x * weight_a + surface->points[1].x * weight_b + surface->points[2].x * weight_c,
+            surface->points[0].y * weight_a + surface->points[1].y * weight_b + surface->points[2].y * weight_c,
+            surface->points[0].z * weight_a + surface->points[1].z * weight_b + surface->points[2].z * weight_c
+        };
+    }
+
+    // The view depth w picks the cascade, the directional intensity is how square the surface is to the light
+    if (shadow != NULL && interpolated_intensity > 0)
+        interpolated_intensity *= shadow_visibility(shadow, position, 1 / interpolated_reciprocal_w, interpolated_intensity < 1 ? interpolated_intensity : 1);
+
+    if (lit_locally) {
+        vec3_t normal = {
+            surface->normals[0].x * weight_a + surface->normals[1].x * weight_b + surface->normals[2].x * weight_c,
+            surface->normals[0].y * weight_a + surface->normals[1].y * weight_b + surface->normals[2].y * weight_c,
+            surface->normals[0].z * weight_a + surface->normals[1].z * weight_b + surface->normals[2].z * weight_c
+        };
+        float normal_length_squared = vec3_dot_ref(&normal, &normal);
+        if (normal_length_squared > 0) {
+            vec3_mul_ref(&normal, &normal, rsqrt_fast(normal_length_squared));
+            interpolated_intensity += light_grid_shade(lights, tile, position, normal);
+        }
+    }
+
+    return interpolated_intensity;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Function to draw a solid pixel at position (x,y) using depth interpolation
+// Function to Gouraud shade the pixel at position (x,y) using depth and light
+// interpolation. Returns false if the pixel is hidden, else updates its depth
+// and gives where its color goes and the factor to light it by, for the span
+// to write the colors in batches. With a cache the light may come from the
+// pixel's block.
 ///////////////////////////////////////////////////////////////////////////////
-void draw_triangle_pixel(
-    int x, int y, uint32_t color,
-    vec4_t point_a, vec4_t point_b, vec4_t point_c
+static bool shade_triangle_pixel(
+    framebuffer_t* target, int x, int y,
+    vec4_t point_a, vec4_t point_b, vec4_t point_c,
+    vec3_t intensities, const triangle_surface_t* surface, const pixel_lighting_t* lighting,
+    shading_cache_t* cache, uint32_t* pixel_offset, uint32_t* pixel_factor
 ) {
+    // Rasterized spans can poke a pixel past the screen edge, skip those
+    if (!framebuffer_contains(target, x, y))
+        return false;
+    uint32_t offset = framebuffer_offset(target, x, y);
+
     // Create three vec2 to find the interpolation
     vec2_t p = { x, y };
-    vec2_t a = vec2_from_vec4(point_a);
-    vec2_t b = vec2_from_vec4(point_b);
-    vec2_t c = vec2_from_vec4(point_c);
+    vec2_t a, b, c;
+    vec2_from_vec4_ref(&a, &point_a);
+    vec2_from_vec4_ref(&b, &point_b);
+    vec2_from_vec4_ref(&c, &point_c);
 
     // Calculate the barycentric coordinates of our point 'p' inside the triangle
-    vec3_t weights = barycentric_weights(a, b, c, p);
+    vec3_t weights = barycentric_weights(&a, &b, &c, &p);
 
     float alpha = weights.x;
     float beta = weights.y;
@@ -74,33 +206,84 @@ void draw_triangle_pixel(
     float interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
 
     // Adjust 1/w so the pixels that are closer to the camera have smaller values
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    float depth = 1.0 - interpolated_reciprocal_w;
 
     // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
-    if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x]) {
-        // Draw a pixel at position (x,y) with a solid color
-        draw_pixel(x, y, color);
+    if (depth < target->depth[offset]) {
+        bool shaded = false;
+        uint32_t* block = cache != NULL ? shading_block(target, cache, x, y, &shaded) : NULL;
+        if (block != NULL && shaded) {
+            *pixel_factor = *block;
+        } else {
+            float interpolated_intensity = light_triangle_point(x, y, weights, interpolated_reciprocal_w, point_a, point_b, point_c, intensities, surface, lighting);
+            *pixel_factor = color_factor(interpolated_intensity);
+            if (block != NULL)
+                *block = *pixel_factor;
+        }
 
         // Update the z-buffer value with the 1/w of this current pixel
-        z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+        target->depth[offset] = depth;
+
+        *pixel_offset = offset;
+        return true;
     }
+    return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-// Function to draw the textured pixel at position (x,y) using depth interpolation
+// Draw the Gouraud shaded pixels of row y from x_start up to x_end. The lit
+// pixels are gathered four at a time and their colors modulated together.
+///////////////////////////////////////////////////////////////////////////////
+static void draw_filled_span(
+    framebuffer_t* target, int y, int x_start, int x_end, uint32_t color,
+    vec4_t point_a, vec4_t point_b, vec4_t point_c,
+    vec3_t intensities, const triangle_surface_t* surface, const pixel_lighting_t* lighting,
+    shading_cache_t* cache
+) {
+    uint32_t colors[4] = { color, color, color, color };
+    uint32_t offsets[4];
+    uint32_t factors[4];
+    int count = 0;
+
+    for (int x = x_start; x < x_end; x++) {
+        if (!shade_triangle_pixel(target, x, y, point_a, point_b, point_c, intensities, surface, lighting, cache, &offsets[count], &factors[count]))
+            continue;
+        if (++count == 4) {
+            uint32_t shaded[4];
+            color_modulate4(shaded, colors, factors);
+            for (int i = 0; i < 4; i++)
+                target->color[offsets[i]] = shaded[i];
+            count = 0;
+        }
+    }
+
+    // The last few pixels of the span one by one
+    for (int i = 0; i < count; i++)
+        target->color[offsets[i]] = color_modulate(color, factors[i]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Function to draw the textured pixel at position (x,y) using depth
+// interpolation. With a cache the color may come from the pixel's block.
 ///////////////////////////////////////////////////////////////////////////////
 void draw_triangle_texel(
-    int x, int y, uint32_t* texture,
+    framebuffer_t* target, int x, int y, texture_t* texture, texture_filter_t filter, float lod,
     vec4_t point_a, vec4_t point_b, vec4_t point_c,
-    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv, shading_cache_t* cache
 ) {
+    // Rasterized spans can poke a pixel past the screen edge, skip those
+    if (!framebuffer_contains(target, x, y))
+        return;
+    uint32_t offset = framebuffer_offset(target, x, y);
+
     vec2_t p = { x, y };
-    vec2_t a = vec2_from_vec4(point_a);
-    vec2_t b = vec2_from_vec4(point_b);
-    vec2_t c = vec2_from_vec4(point_c);
+    vec2_t a, b, c;
+    vec2_from_vec4_ref(&a, &point_a);
+    vec2_from_vec4_ref(&b, &point_b);
+    vec2_from_vec4_ref(&c, &point_c);
 
     // Calculate the barycentric coordinates of our point 'p' inside the triangle
-    vec3_t weights = barycentric_weights(a, b, c, p);
+    vec3_t weights = barycentric_weights(&a, &b, &c, &p);
 
     float alpha = weights.x;
     float beta = weights.y;
@@ -122,20 +305,24 @@ void draw_triangle_texel(
     interpolated_u /= interpolated_reciprocal_w;
     interpolated_v /= interpolated_reciprocal_w;
 
-    // Map the UV coordinate to the full texture width and height
-    int tex_x = abs((int)(interpolated_u * texture_width)) % texture_width;
-    int tex_y = abs((int)(interpolated_v * texture_height)) % texture_height;
-
     // Adjust 1/w so the pixels that are closer to the camera have smaller values
     interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
 
     // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
-    if (interpolated_reciprocal_w < z_buffer[(window_width * y) + x]) {
-        // Draw a pixel at position (x,y) with the color that comes from the mapped texture
-        draw_pixel(x, y, texture[(texture_width * tex_y) + tex_x]);
+    if (interpolated_reciprocal_w < target->depth[offset]) {
+        bool shaded = false;
+        uint32_t* block = cache != NULL ? shading_block(target, cache, x, y, &shaded) : NULL;
+        if (block != NULL && shaded) {
+            target->color[offset] = *block;
+        } else {
+            // Draw a pixel at position (x,y) with the color that comes from the mapped texture
+            target->color[offset] = texture_sample(texture, interpolated_u, interpolated_v, lod, filter);
+            if (block != NULL)
+                *block = target->color[offset];
+        }
 
         // Update the z-buffer value with the 1/w of this current pixel
-        z_buffer[(window_width * y) + x] = interpolated_reciprocal_w;
+        target->depth[offset] = interpolated_reciprocal_w;
     }
 }
 
@@ -160,10 +347,11 @@ void draw_triangle_texel(
 //
 ///////////////////////////////////////////////////////////////////////////////
 void draw_textured_triangle(
+    framebuffer_t* target,
     int x0, int y0, float z0, float w0, float u0, float v0,
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
+    texture_t* texture, texture_filter_t filter
 ) {
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1) {
@@ -204,6 +392,20 @@ void draw_textured_triangle(
     tex2_t b_uv = { u1, v1 };
     tex2_t c_uv = { u2, v2 };
 
+    // Select the mip level once for the whole triangle
+    float lod = 0;
+    if (filter != filter_no_mip) {
+        lod = texture_triangle_lod(texture, x0, y0, u0, v0, x1, y1, u1, v1, x2, y2, u2, v2);
+    }
+
+    // Sample per block where the target's shading rate is coarse
+    shading_cache_t block_shading;
+    shading_cache_t* cache = NULL;
+    if (target->shading_rate != NULL) {
+        cache = &block_shading;
+        shading_cache_reset(cache, x0, x1, x2);
+    }
+
     ///////////////////////////////////////////////////////
     // Render the upper part of the triangle (flat-bottom)
     ///////////////////////////////////////////////////////
@@ -214,7 +416,10 @@ void draw_textured_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        int y_start = y0;
+        int y_end = y1;
+        clip_rows(target, &y_start, &y_end);
+        for (int y = y_start; y <= y_end; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -224,7 +429,7 @@ void draw_textured_triangle(
 
             for (int x = x_start; x < x_end; x++) {
                 // Draw our pixel with the color that comes from the texture
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+                draw_triangle_texel(target, x, y, texture, filter, lod, point_a, point_b, point_c, a_uv, b_uv, c_uv, cache);
             }
         }
     }
@@ -239,7 +444,10 @@ void draw_textured_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        int y_start = y1;
+        int y_end = y2;
+        clip_rows(target, &y_start, &y_end);
+        for (int y = y_start; y <= y_end; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -249,7 +457,7 @@ void draw_textured_triangle(
 
             for (int x = x_start; x < x_end; x++) {
                 // Draw our pixel with the color that comes from the texture
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+                draw_triangle_texel(target, x, y, texture, filter, lod, point_a, point_b, point_c, a_uv, b_uv, c_uv, cache);
             }
         }
     }
@@ -279,35 +487,181 @@ void draw_textured_triangle(
 //
 ///////////////////////////////////////////////////////////////////////////////
 void draw_filled_triangle(
-    int x0, int y0, float z0, float w0,
-    int x1, int y1, float z1, float w1,
-    int x2, int y2, float z2, float w2,
-    uint32_t color
+    framebuffer_t* target,
+    int x0, int y0, float z0, float w0, float i0,
+    int x1, int y1, float z1, float w1, float i1,
+    int x2, int y2, float z2, float w2, float i2,
+    uint32_t color, const triangle_surface_t* surface, const pixel_lighting_t* lighting
 ) {
+    // Which of the given vertices ends up as a, b and c, to sort the surface the same way
+    int vertex0 = 0, vertex1 = 1, vertex2 = 2;
+
     // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
     if (y0 > y1) {
         int_swap(&y0, &y1);
         int_swap(&x0, &x1);
         float_swap(&z0, &z1);
         float_swap(&w0, &w1);
+        float_swap(&i0, &i1);
+        int_swap(&vertex0, &vertex1);
     }
     if (y1 > y2) {
         int_swap(&y1, &y2);
         int_swap(&x1, &x2);
         float_swap(&z1, &z2);
         float_swap(&w1, &w2);
+        float_swap(&i1, &i2);
+        int_swap(&vertex1, &vertex2);
     }
     if (y0 > y1) {
         int_swap(&y0, &y1);
         int_swap(&x0, &x1);
         float_swap(&z0, &z1);
         float_swap(&w0, &w1);
+        float_swap(&i0, &i1);
+        int_swap(&vertex0, &vertex1);
     }
 
     // Create three vector points after we sort the vertices
     vec4_t point_a = { x0, y0, z0, w0 };
     vec4_t point_b = { x1, y1, z1, w1 };
     vec4_t point_c = { x2, y2, z2, w2 };
+    vec3_t intensities = { i0, i1, i2 };
+
+    // Shadows and local lights need the world surface, skip it all when there are none
+    const light_grid_t* lights = lighting != NULL ? lighting->lights : NULL;
+    pixel_lighting_t sorted_lighting = {
+        lights != NULL && lights->num_lights > 0 ? lights : NULL,
+        lighting != NULL ? lighting->shadow : NULL
+    };
+    triangle_surface_t sorted_surface;
+    if (sorted_lighting.lights != NULL || sorted_lighting.shadow != NULL) {
+        sorted_surface.points[0] = surface->points[vertex0];
+        sorted_surface.points[1] = surface->points[vertex1];
+        sorted_surface.points[2] = surface->points[vertex2];
+        sorted_surface.normals[0] = surface->normals[vertex0];
+        sorted_surface.normals[1] = surface->normals[vertex1];
+        sorted_surface.normals[2] = surface->normals[vertex2];
+    }
+
+    // Shading per block where the target's shading rate is coarse
+    shading_cache_t block_shading;
+    shading_cache_t* cache = NULL;
+    if (target->shading_rate != NULL) {
+        cache = &block_shading;
+        shading_cache_reset(cache, x0, x1, x2);
+    }
+
+    ///////////////////////////////////////////////////////
+    // Render the upper part of the triangle (flat-bottom)
+    ///////////////////////////////////////////////////////
+    float inv_slope_1 = 0;
+    float inv_slope_2 = 0;
+
+    if (y1 - y0 != 0) inv_slope_1 = (float)(x1 - x0) / abs(y1 - y0);
+    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+
+    if (y1 - y0 != 0) {
+        int y_start = y0;
+        int y_end = y1;
+        clip_rows(target, &y_start, &y_end);
+        for (int y = y_start; y <= y_end; y++) {
+            int x_start = x1 + (y - y1) * inv_slope_1;
+            int x_end = x0 + (y - y0) * inv_slope_2;
+
+            if (x_end < x_start) {
+                int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
+            }
+
+            // Draw the row with the color shaded by the light of the vertices
+            draw_filled_span(target, y, x_start, x_end, color, point_a, point_b, point_c, intensities, &sorted_surface, &sorted_lighting, cache);
+        }
+    }
+
+    ///////////////////////////////////////////////////////
+    // Render the bottom part of the triangle (flat-top)
+    ///////////////////////////////////////////////////////
+    inv_slope_1 = 0;
+    inv_slope_2 = 0;
+
+    if (y2 - y1 != 0) inv_slope_1 = (float)(x2 - x1) / abs(y2 - y1);
+    if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
+
+    if (y2 - y1 != 0) {
+        int y_start = y1;
+        int y_end = y2;
+        clip_rows(target, &y_start, &y_end);
+        for (int y = y_start; y <= y_end; y++) {
+            int x_start = x1 + (y - y1) * inv_slope_1;
+            int x_end = x0 + (y - y0) * inv_slope_2;
+
+            if (x_end < x_start) {
+                int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
+            }
+
+            // Draw the row with the color shaded by the light of the vertices
+            draw_filled_span(target, y, x_start, x_end, color, point_a, point_b, point_c, intensities, &sorted_surface, &sorted_lighting, cache);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Function to keep the nearest depth at position (x,y), for triangles drawn
+// with a parallel projection whose depth is linear across the screen
+///////////////////////////////////////////////////////////////////////////////
+void draw_depth_pixel(framebuffer_t* target, int x, int y, vec4_t point_a, vec4_t point_b, vec4_t point_c) {
+    // Rasterized spans can poke a pixel past the screen edge, skip those
+    if (!framebuffer_contains(target, x, y))
+        return;
+    uint32_t offset = framebuffer_offset(target, x, y);
+
+    vec2_t p = { x, y };
+    vec2_t a, b, c;
+    vec2_from_vec4_ref(&a, &point_a);
+    vec2_from_vec4_ref(&b, &point_b);
+    vec2_from_vec4_ref(&c, &point_c);
+
+    // Calculate the barycentric coordinates of our point 'p' inside the triangle
+    vec3_t weights = barycentric_weights(&a, &b, &c, &p);
+
+    // With no perspective the depth interpolates straight across the triangle
+    float depth = point_a.z * weights.x + point_b.z * weights.y + point_c.z * weights.z;
+
+    if (depth < target->depth[offset])
+        target->depth[offset] = depth;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw only the depth of a triangle with the flat-top/flat-bottom method,
+// as seen from a light for its shadow map. Nothing is written to the colors.
+///////////////////////////////////////////////////////////////////////////////
+void draw_depth_triangle(
+    framebuffer_t* target,
+    int x0, int y0, float z0,
+    int x1, int y1, float z1,
+    int x2, int y2, float z2
+) {
+    // We need to sort the vertices by y-coordinate ascending (y0 < y1 < y2)
+    if (y0 > y1) {
+        int_swap(&y0, &y1);
+        int_swap(&x0, &x1);
+        float_swap(&z0, &z1);
+    }
+    if (y1 > y2) {
+        int_swap(&y1, &y2);
+        int_swap(&x1, &x2);
+        float_swap(&z1, &z2);
+    }
+    if (y0 > y1) {
+        int_swap(&y0, &y1);
+        int_swap(&x0, &x1);
+        float_swap(&z0, &z1);
+    }
+
+    // Create three vector points after we sort the vertices
+    vec4_t point_a = { x0, y0, z0, 1 };
+    vec4_t point_b = { x1, y1, z1, 1 };
+    vec4_t point_c = { x2, y2, z2, 1 };
 
     ///////////////////////////////////////////////////////
     // Render the upper part of the triangle (flat-bottom)
@@ -319,7 +673,10 @@ void draw_filled_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        int y_start = y0;
+        int y_end = y1;
+        clip_rows(target, &y_start, &y_end);
+        for (int y = y_start; y <= y_end; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -328,8 +685,7 @@ void draw_filled_triangle(
             }
 
             for (int x = x_start; x < x_end; x++) {
-                // Draw our pixel with a solid color
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
+                draw_depth_pixel(target, x, y, point_a, point_b, point_c);
             }
         }
     }
@@ -344,7 +700,10 @@ void draw_filled_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        int y_start = y1;
+        int y_end = y2;
+        clip_rows(target, &y_start, &y_end);
+        for (int y = y_start; y <= y_end; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -353,9 +712,274 @@ void draw_filled_triangle(
             }
 
             for (int x = x_start; x < x_end; x++) {
-                // Draw our pixel with a solid color
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
+                draw_depth_pixel(target, x, y, point_a, point_b, point_c);
             }
         }
     }
 }
+
+///////////////////////////////////////////////////////////////////////////////
+// Multisampling. Every pixel has FRAMEBUFFER_SAMPLES samples on a rotated
+// grid, each with its own coverage and depth, but a triangle is shaded only
+// once per pixel: in the middle when it wins all the samples, else at the
+// first one it wins. A pixel it only partly wins splits into a color per
+// sample, until framebuffer_resolve averages them.
+///////////////////////////////////////////////////////////////////////////////
+static const float sample_offsets[FRAMEBUFFER_SAMPLES][2] = {
+    { 0.375f, 0.125f }, { 0.875f, 0.375f }, { 0.125f, 0.625f }, { 0.625f, 0.875f }
+};
+
+#define ALL_SAMPLES ((1 << FRAMEBUFFER_SAMPLES) - 1)
+
+// An edge as the function step_x * x + step_y * y + offset, positive on the triangle's side
+typedef struct {
+    float step_x;
+    float step_y;
+    float offset;
+    bool owns_ties; // whether samples right on the edge are inside, so only one of two triangles sharing it draws them
+} triangle_edge_t;
+
+typedef struct {
+    triangle_edge_t edges[3]; // opposite a, b and c, over area they give the barycentric weights
+    float area;               // twice the area of the triangle
+    float depth_step_x;       // 1 - 1/w across the screen, like the edges
+    float depth_step_y;
+    float depth_offset;
+} sample_setup_t;
+
+// Twice the area of a triangle, negative when it is wound the other way
+static float signed_area(vec4_t a, vec4_t b, vec4_t c) {
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+// The edge from a to b of a triangle wound with a positive area
+static triangle_edge_t make_edge(vec4_t a, vec4_t b) {
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    triangle_edge_t edge = { -dy, dx, dy * a.x - dx * a.y, dy > 0 || (dy == 0 && dx < 0) };
+    return edge;
+}
+
+static float edge_value(const triangle_edge_t* edge, float x, float y) {
+    return edge->step_x * x + edge->step_y * y + edge->offset;
+}
+
+// Set up the edges and depth of a triangle wound with a positive area, false when it covers nothing
+static bool setup_samples(sample_setup_t* setup, vec4_t a, vec4_t b, vec4_t c) {
+    setup->edges[0] = make_edge(b, c);
+    setup->edges[1] = make_edge(c, a);
+    setup->edges[2] = make_edge(a, b);
+    setup->area = signed_area(a, b, c);
+    if (!(setup->area > 0))
+        return false;
+
+    // 1/w is linear across the screen, the sum of the vertices' 1/w by their weights
+    float weight_a = 1 / a.w / setup->area;
+    float weight_b = 1 / b.w / setup->area;
+    float weight_c = 1 / c.w / setup->area;
+    setup->depth_step_x = -(weight_a * setup->edges[0].step_x + weight_b * setup->edges[1].step_x + weight_c * setup->edges[2].step_x);
+    setup->depth_step_y = -(weight_a * setup->edges[0].step_y + weight_b * setup->edges[1].step_y + weight_c * setup->edges[2].step_y);
+    setup->depth_offset = 1 - (weight_a * setup->edges[0].offset + weight_b * setup->edges[1].offset + weight_c * setup->edges[2].offset);
+    return true;
+}
+
+// The pixels whose samples the triangle may cover, clipped to the target, false when there are none
+static bool sample_bounds(const framebuffer_t* target, vec4_t a, vec4_t b, vec4_t c, int* x_min, int* x_max, int* y_min, int* y_max) {
+    *x_min = (int)floorf(fminf(a.x, fminf(b.x, c.x)));
+    *x_max = (int)floorf(fmaxf(a.x, fmaxf(b.x, c.x)));
+    *y_min = (int)floorf(fminf(a.y, fminf(b.y, c.y)));
+    *y_max = (int)floorf(fmaxf(a.y, fmaxf(b.y, c.y)));
+    if (*x_min < 0) *x_min = 0;
+    if (*x_max > target->width - 1) *x_max = target->width - 1;
+    if (*y_min < target->clip_top) *y_min = target->clip_top;
+    if (*y_max > target->clip_bottom - 1) *y_max = target->clip_bottom - 1;
+    return *x_min <= *x_max && *y_min <= *y_max;
+}
+
+// The samples of pixel (x,y) the triangle covers and is nearer at, as bits, with their depths
+static int sample_pixel(const sample_setup_t* setup, const framebuffer_t* target, int x, int y, uint32_t index, float depths[FRAMEBUFFER_SAMPLES]) {
+    const float* stored_depths = target->sample_depth + FRAMEBUFFER_SAMPLES * index;
+    int mask = 0;
+    for (int s = 0; s < FRAMEBUFFER_SAMPLES; s++) {
+        float sample_x = x + sample_offsets[s][0];
+        float sample_y = y + sample_offsets[s][1];
+        bool inside = true;
+        for (int e = 0; e < 3 && inside; e++) {
+            float value = edge_value(&setup->edges[e], sample_x, sample_y);
+            inside = value > 0 || (value == 0 && setup->edges[e].owns_ties);
+        }
+        if (!inside)
+            continue;
+        depths[s] = setup->depth_step_x * sample_x + setup->depth_step_y * sample_y + setup->depth_offset;
+        if (depths[s] < stored_depths[s])
+            mask |= 1 << s;
+    }
+    return mask;
+}
+
+// The barycentric weights where pixel (x,y) is shaded for the samples in mask
+static vec3_t shading_weights(const sample_setup_t* setup, int x, int y, int mask) {
+    // The middle of the pixel is inside the four samples, so only inside the triangle when they all are
+    float point_x = x + 0.5f;
+    float point_y = y + 0.5f;
+    if (mask != ALL_SAMPLES) {
+        int s = 0;
+        while (!(mask & (1 << s)))
+            s++;
+        point_x = x + sample_offsets[s][0];
+        point_y = y + sample_offsets[s][1];
+    }
+    vec3_t weights = {
+        edge_value(&setup->edges[0], point_x, point_y) / setup->area,
+        edge_value(&setup->edges[1], point_x, point_y) / setup->area,
+        0
+    };
+    weights.z = 1 - weights.x - weights.y;
+    return weights;
+}
+
+// Keep the shaded color and the depths of the samples in mask
+static void write_samples(framebuffer_t* target, int x, int y, uint32_t index, int mask, const float depths[FRAMEBUFFER_SAMPLES], uint32_t color) {
+    float* stored_depths = target->sample_depth + FRAMEBUFFER_SAMPLES * index;
+    uint32_t* samples = target->sample_color + FRAMEBUFFER_SAMPLES * index;
+    uint32_t offset = framebuffer_offset(target, x, y);
+    for (int s = 0; s < FRAMEBUFFER_SAMPLES; s++) {
+        if (mask & (1 << s))
+            stored_depths[s] = depths[s];
+    }
+
+    // Won all over, the pixel is one color again
+    if (mask == ALL_SAMPLES) {
+        target->color[offset] = color;
+        target->edge[index] = 0;
+        return;
+    }
+
+    // An edge goes through, the samples start from the color the pixel had
+    if (!target->edge[index]) {
+        for (int s = 0; s < FRAMEBUFFER_SAMPLES; s++)
+            samples[s] = target->color[offset];
+        target->edge[index] = 1;
+    }
+    for (int s = 0; s < FRAMEBUFFER_SAMPLES; s++) {
+        if (mask & (1 << s))
+            samples[s] = color;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a Gouraud shaded triangle into a multisampled target, from its exact
+// screen positions rather than whole pixels
+///////////////////////////////////////////////////////////////////////////////
+void draw_filled_triangle_multisampled(
+    framebuffer_t* target,
+    float x0, float y0, float z0, float w0, float i0,
+    float x1, float y1, float z1, float w1, float i1,
+    float x2, float y2, float z2, float w2, float i2,
+    uint32_t color, const triangle_surface_t* surface, const pixel_lighting_t* lighting
+) {
+    vec4_t point_a = { x0, y0, z0, w0 };
+    vec4_t point_b = { x1, y1, z1, w1 };
+    vec4_t point_c = { x2, y2, z2, w2 };
+    vec3_t intensities = { i0, i1, i2 };
+    triangle_surface_t wound_surface = *surface;
+
+    // Wind the triangle with a positive area, b and c trade everything
+    if (signed_area(point_a, point_b, point_c) < 0) {
+        vec4_t point = point_b;
+        point_b = point_c;
+        point_c = point;
+        float_swap(&intensities.y, &intensities.z);
+        wound_surface.points[1] = surface->points[2];
+        wound_surface.points[2] = surface->points[1];
+        wound_surface.normals[1] = surface->normals[2];
+        wound_surface.normals[2] = surface->normals[1];
+    }
+
+    // Like the filled triangles, skip the local lights when there are none
+    const light_grid_t* lights = lighting != NULL ? lighting->lights : NULL;
+    pixel_lighting_t wound_lighting = {
+        lights != NULL && lights->num_lights > 0 ? lights : NULL,
+        lighting != NULL ? lighting->shadow : NULL
+    };
+
+    sample_setup_t setup;
+    int x_min, x_max, y_min, y_max;
+    if (!setup_samples(&setup, point_a, point_b, point_c) || !sample_bounds(target, point_a, point_b, point_c, &x_min, &x_max, &y_min, &y_max))
+        return;
+
+    for (int y = y_min; y <= y_max; y++) {
+        for (int x = x_min; x <= x_max; x++) {
+            uint32_t index = framebuffer_sample_index(target, x, y);
+            float depths[FRAMEBUFFER_SAMPLES];
+            int mask = sample_pixel(&setup, target, x, y, index, depths);
+            if (mask == 0)
+                continue;
+
+            // Shade once for all the samples won
+            vec3_t weights = shading_weights(&setup, x, y, mask);
+            float interpolated_reciprocal_w = (1 / point_a.w) * weights.x + (1 / point_b.w) * weights.y + (1 / point_c.w) * weights.z;
+            float intensity = light_triangle_point(x, y, weights, interpolated_reciprocal_w, point_a, point_b, point_c, intensities, &wound_surface, &wound_lighting);
+            write_samples(target, x, y, index, mask, depths, color_modulate(color, color_factor(intensity)));
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a textured triangle into a multisampled target, from its exact screen
+// positions rather than whole pixels
+///////////////////////////////////////////////////////////////////////////////
+void draw_textured_triangle_multisampled(
+    framebuffer_t* target,
+    float x0, float y0, float z0, float w0, float u0, float v0,
+    float x1, float y1, float z1, float w1, float u1, float v1,
+    float x2, float y2, float z2, float w2, float u2, float v2,
+    texture_t* texture, texture_filter_t filter
+) {
+    vec4_t point_a = { x0, y0, z0, w0 };
+    vec4_t point_b = { x1, y1, z1, w1 };
+    vec4_t point_c = { x2, y2, z2, w2 };
+
+    // Flip the V component to account for inverted UV-coordinates (V grows downwards)
+    tex2_t a_uv = { u0, 1.0 - v0 };
+    tex2_t b_uv = { u1, 1.0 - v1 };
+    tex2_t c_uv = { u2, 1.0 - v2 };
+
+    // Wind the triangle with a positive area, b and c trade everything
+    if (signed_area(point_a, point_b, point_c) < 0) {
+        vec4_t point = point_b;
+        point_b = point_c;
+        point_c = point;
+        tex2_t uv = b_uv;
+        b_uv = c_uv;
+        c_uv = uv;
+    }
+
+    sample_setup_t setup;
+    int x_min, x_max, y_min, y_max;
+    if (!setup_samples(&setup, point_a, point_b, point_c) || !sample_bounds(target, point_a, point_b, point_c, &x_min, &x_max, &y_min, &y_max))
+        return;
+
+    // Select the mip level once for the whole triangle
+    float lod = 0;
+    if (filter != filter_no_mip) {
+        lod = texture_triangle_lod(texture, point_a.x, point_a.y, a_uv.u, a_uv.v, point_b.x, point_b.y, b_uv.u, b_uv.v, point_c.x, point_c.y, c_uv.u, c_uv.v);
+    }
+
+    for (int y = y_min; y <= y_max; y++) {
+        for (int x = x_min; x <= x_max; x++) {
+            uint32_t index = framebuffer_sample_index(target, x, y);
+            float depths[FRAMEBUFFER_SAMPLES];
+            int mask = sample_pixel(&setup, target, x, y, index, depths);
+            if (mask == 0)
+                continue;
+
+            // Sample the texture once for all the samples won
+            vec3_t weights = shading_weights(&setup, x, y, mask);
+            float interpolated_reciprocal_w = (1 / point_a.w) * weights.x + (1 / point_b.w) * weights.y + (1 / point_c.w) * weights.z;
+            float interpolated_u = ((a_uv.u / point_a.w) * weights.x + (b_uv.u / point_b.w) * weights.y + (c_uv.u / point_c.w) * weights.z) / interpolated_reciprocal_w;
+            float interpolated_v = ((a_uv.v / point_a.w) * weights.x + (b_uv.v / point_b.w) * weights.y + (c_uv.v / point_c.w) * weights.z) / interpolated_reciprocal_w;
+            write_samples(target, x, y, index, mask, depths, texture_sample(texture, interpolated_u, interpolated_v, lod, filter));
+        }
+    }
+}
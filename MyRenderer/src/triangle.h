@@ -4,37 +4,87 @@
 #include <stdint.h>
 #include "texture.h"
 #include "vector.h"
+#include "framebuffer.h"
+#include "light.h"
 
 typedef struct {
     int a;
     int b;
     int c;
+    int a_normal;             // indices into the mesh normals, 1-based like a, b and c, 0 when the obj gave none
+    int b_normal;
+    int c_normal;
     tex2_t a_uv;
     tex2_t b_uv;
     tex2_t c_uv;
     uint32_t color;
+    texture_handle_t texture; // texture of its material, TEXTURE_NONE to use the mesh texture
+    vec3_t normal;            // unit normal in object space, zero for a degenerate face
+    float plane_offset;       // dot(normal, a), a point p is in front of the face when dot(normal, p) > plane_offset
 } face_t;
 
+// Where the vertices of a triangle are in the world, for the local lights to shade it per pixel
+typedef struct {
+    vec3_t points[3];
+    vec3_t normals[3]; // unit length
+} triangle_surface_t;
+
+struct shadow_t;
+
+// Light a pixel gets beyond what was interpolated from its vertices, either part can be NULL
+typedef struct {
+    const light_grid_t* lights;     // local lights binned to screen tiles
+    const struct shadow_t* shadow;  // shadow maps of the directional light
+} pixel_lighting_t;
+
 typedef struct {
     vec4_t points[3];
     tex2_t texcoords[3];
+    float intensities[3]; // light at each vertex, interpolated across the triangle
     uint32_t color;
+    texture_handle_t texture;
+    triangle_surface_t surface;
 } triangle_t;
 
-void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
+void draw_triangle(framebuffer_t* target, int x0, int y0, int x1, int y1, int x2, int y2, uint32_t color);
 
 void draw_filled_triangle(
-    int x0, int y0, float z0, float w0,
-    int x1, int y1, float z1, float w1,
-    int x2, int y2, float z2, float w2,
-    uint32_t color
+    framebuffer_t* target,
+    int x0, int y0, float z0, float w0, float i0,
+    int x1, int y1, float z1, float w1, float i1,
+    int x2, int y2, float z2, float w2, float i2,
+    uint32_t color, const triangle_surface_t* surface, const pixel_lighting_t* lighting
+);
+
+void draw_depth_triangle(
+    framebuffer_t* target,
+    int x0, int y0, float z0,
+    int x1, int y1, float z1,
+    int x2, int y2, float z2
 );
 
 void draw_textured_triangle(
+    framebuffer_t* target,
     int x0, int y0, float z0, float w0, float u0, float v0,
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2,
-    uint32_t* texture
+    texture_t* texture, texture_filter_t filter
+);
+
+void draw_filled_triangle_multisampled(
+    framebuffer_t* target,
+    float x0, float y0, float z0, float w0, float i0,
+    float x1, float y1, float z1, float w1, float i1,
+    float x2, float y2, float z2, float w2, float i2,
+    uint32_t color, const triangle_surface_t* surface, const pixel_lighting_t* lighting
+);
+
+void draw_textured_triangle_multisampled(
+    framebuffer_t* target,
+    float x0, float y0, float z0, float w0, float u0, float v0,
+    float x1, float y1, float z1, float w1, float u1, float v1,
+    float x2, float y2, float z2, float w2, float u2, float v2,
+    texture_t* texture, texture_filter_t filter
 );
 
 #endif
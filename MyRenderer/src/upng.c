@@ -28,6 +28,17 @@ freely, subject to the following restrictions:
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
+
+/* vectorized unfiltering: SSE2 is always there on x64, AVX2 only when the compiler is told to target it */
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UPNG_USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(UPNG_USE_SSE2) && defined(__AVX2__)
+#define UPNG_USE_AVX2
+#include <immintrin.h>
+#endif
 
 #include "upng.h"
 
@@ -98,6 +109,8 @@ struct upng_t {
 
 	upng_state		state;
 	upng_source		source;
+
+	unsigned		flags;
 };
 
 typedef struct huffman_tree {
@@ -106,6 +119,48 @@ typedef struct huffman_tree {
 	unsigned numcodes;	/*number of symbols in the alphabet = number of codes */
 } huffman_tree;
 
+/* lookup table decoding: the low FAST_BITS bits of the bit buffer index the primary table, longer codes
+   continue in a second level table linked from the primary entry. FAST_TABLE_SIZE has room for the primary
+   table and the second level tables of any complete deflate code (zlib bounds them at 1332 entries). */
+#define FAST_BITS 10
+#define FAST_TABLE_SIZE 2048
+
+typedef struct huffman_entry {
+	unsigned short value;	/*the decoded symbol, or the offset of the second level table for a link */
+	unsigned char bits;	/*number of bits this entry consumes, 0 for a link (or an unused code) */
+	unsigned char sub_bits;	/*index bits of the linked second level table */
+} huffman_entry;
+
+/* reads the zlib stream straight out of the IDAT chunks of the source, hopping over chunk boundaries */
+typedef struct bit_reader {
+	const unsigned char *chunk;	/*header of the IDAT chunk being read, NULL once past the last one */
+	const unsigned char *end;	/*end of the source buffer */
+	const unsigned char *in;	/*payload of the current chunk */
+	unsigned long inlength;
+	unsigned long pos;	/*next byte of in to shift into the buffer */
+	unsigned long overrun;	/*zero bytes shifted in after the last IDAT chunk */
+	uint64_t buffer;	/*bits are consumed from the lsb */
+	unsigned count;	/*number of valid bits in buffer */
+} bit_reader;
+
+/* state of a streaming decode: inflated bytes go to a ring window that keeps the deflate history, and every
+   complete scanline is unfiltered into a two-row window and handed to the row callback right away */
+typedef struct png_stream {
+	bit_reader br;
+	unsigned char *window;
+	unsigned long window_mask;	/*window size - 1, the size is a power of two */
+	unsigned long pos;	/*total number of inflated bytes */
+	unsigned long flushed;	/*total number of inflated bytes already unfiltered */
+	unsigned long total;	/*expected number of inflated bytes, (linebytes + 1) * height */
+	unsigned long linebytes;
+	unsigned long bytewidth;
+	unsigned y;
+	unsigned char *rows[2];	/*the scanline being unfiltered and the previous one */
+	unsigned char *scanline;	/*contiguous copy of a filtered scanline that wraps around the window */
+	upng_row_callback callback;
+	void *user;
+} png_stream;
+
 static const unsigned LENGTH_BASE[29] = {	/*the base lengths represented by codes 257-285 */
 	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
 	67, 83, 99, 115, 131, 163, 195, 227, 258
@@ -688,6 +743,109 @@ static int paeth_predictor(int a, int b, int c)
 		return c;
 }
 
+#if defined(UPNG_USE_SSE2)
+static __m128i load_pixel(const unsigned char *p)
+{
+	int value;
+	memcpy(&value, p, 4);
+	return _mm_cvtsi32_si128(value);
+}
+
+static void store_pixel(unsigned char *p, __m128i pixel)
+{
+	int value = _mm_cvtsi128_si32(pixel);
+	memcpy(p, &value, 4);
+}
+
+/*|x| of each signed 16-bit lane*/
+static __m128i abs_epi16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+/*(x & mask) | (y & ~mask)*/
+static __m128i select_si128(__m128i mask, __m128i x, __m128i y)
+{
+	return _mm_or_si128(_mm_and_si128(mask, x), _mm_andnot_si128(mask, y));
+}
+
+/*
+   SIMD counterpart of unfilter_scanline, same arguments. Up is done 16 (or 32 with AVX2) bytes at a time for any pixel size;
+   Sub, Average and Paeth depend on the pixel to the left so they run one 4-byte pixel per step, with the channels in parallel
+   lanes, and only for 4 bytes per pixel (RGBA8). returns 0 for the rows it does not handle, which then go to the scalar code.
+ */
+static int unfilter_scanline_simd(unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
+{
+	const __m128i zero = _mm_setzero_si128();
+	unsigned long i = 0;
+
+	if (filterType == 2 && precon) {
+#if defined(UPNG_USE_AVX2)
+		for (; i + 32 <= length; i += 32) {
+			__m256i x = _mm256_loadu_si256((const __m256i*)(scanline + i));
+			__m256i b = _mm256_loadu_si256((const __m256i*)(precon + i));
+			_mm256_storeu_si256((__m256i*)(recon + i), _mm256_add_epi8(x, b));
+		}
+#endif
+		for (; i + 16 <= length; i += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+			__m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+			_mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+		}
+		for (; i < length; i++)
+			recon[i] = scanline[i] + precon[i];
+		return 1;
+	}
+
+	if (bytewidth != 4 || length % 4 != 0) {
+		return 0;
+	}
+
+	if (filterType == 1) {
+		__m128i a = zero;
+		for (; i < length; i += 4) {
+			a = _mm_add_epi8(load_pixel(scanline + i), a);
+			store_pixel(recon + i, a);
+		}
+		return 1;
+	} else if (filterType == 3) {
+		/* floor((a + b) / 2) from the rounding up average of pavgb */
+		const __m128i one = _mm_set1_epi8(1);
+		__m128i a = zero;
+		for (; i < length; i += 4) {
+			__m128i b = precon ? load_pixel(precon + i) : zero;
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+			a = _mm_add_epi8(load_pixel(scanline + i), average);
+			store_pixel(recon + i, a);
+		}
+		return 1;
+	} else if (filterType == 4) {
+		/* a, b and c widened to 16-bit lanes; pa = |b - c|, pb = |a - c|, pc = |a + b - 2c| as in paeth_predictor */
+		__m128i a = zero, c = zero;
+		for (; i < length; i += 4) {
+			__m128i b = precon ? _mm_unpacklo_epi8(load_pixel(precon + i), zero) : zero;
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(a, c);
+			__m128i pc = abs_epi16(_mm_add_epi16(pa, pb));
+			__m128i smallest, predictor;
+
+			pa = abs_epi16(pa);
+			pb = abs_epi16(pb);
+			smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			predictor = select_si128(_mm_cmpeq_epi16(pa, smallest), a, select_si128(_mm_cmpeq_epi16(pb, smallest), b, c));
+
+			a = _mm_add_epi8(load_pixel(scanline + i), _mm_packus_epi16(predictor, predictor));
+			store_pixel(recon + i, a);
+			a = _mm_unpacklo_epi8(a, zero);
+			c = b;
+		}
+		return 1;
+	}
+
+	return 0;
+}
+#endif
+
 static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned char *scanline, const unsigned char *precon, unsigned long bytewidth, unsigned char filterType, unsigned long length)
 {
 	/*
@@ -699,6 +857,13 @@ static void unfilter_scanline(upng_t* upng, unsigned char *recon, const unsigned
 	 */
 
 	unsigned long i;
+
+#if defined(UPNG_USE_SSE2)
+	if (!(upng->flags & UPNG_FLAG_SCALAR_UNFILTER) && unfilter_scanline_simd(recon, scanline, precon, bytewidth, filterType, length)) {
+		return;
+	}
+#endif
+
 	switch (filterType) {
 	case 0:
 		for (i = 0; i < length; i++)
@@ -830,6 +995,530 @@ static void post_process_scanlines(upng_t* upng, unsigned char *out, unsigned ch
 	}
 }
 
+/*find the next IDAT chunk after the given one, NULL at IEND or the end of the source*/
+static const unsigned char *next_idat_chunk(const unsigned char *chunk, const unsigned char *end)
+{
+	while (chunk + 12 <= end) {
+		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
+			return chunk;
+		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
+			return NULL;
+		}
+		chunk += upng_chunk_length(chunk) + 12;
+	}
+	return NULL;
+}
+
+static void bit_reader_set_chunk(bit_reader *br, const unsigned char *chunk)
+{
+	br->chunk = chunk;
+	br->in = chunk ? chunk + 8 : NULL;
+	br->inlength = chunk ? upng_chunk_length(chunk) : 0;
+	br->pos = 0;
+}
+
+static void bit_reader_init(bit_reader *br, const unsigned char *source, unsigned long size)
+{
+	br->end = source + size;
+	br->overrun = 0;
+	br->buffer = 0;
+	br->count = 0;
+	bit_reader_set_chunk(br, next_idat_chunk(source + 33, br->end));
+}
+
+/*next byte of the zlib stream, moving on to the next IDAT chunk when the current one is used up*/
+static unsigned char bit_reader_byte(bit_reader *br)
+{
+	while (br->pos >= br->inlength) {
+		if (br->chunk == NULL) {
+			br->overrun++;
+			return 0;
+		}
+		bit_reader_set_chunk(br, next_idat_chunk(br->chunk + br->inlength + 12, br->end));
+	}
+	return br->in[br->pos++];
+}
+
+/*top the bit buffer up to at least 57 bits*/
+static void bit_reader_refill(bit_reader *br)
+{
+	if (br->pos + 8 <= br->inlength) {
+		/* load 8 bytes at once (little-endian targets only), keeping the whole bytes that fit; the bits above
+		   count are the next bytes of this chunk, so loading them again later ORs in the same values */
+		uint64_t word;
+		memcpy(&word, br->in + br->pos, sizeof(word));
+		br->buffer |= word << br->count;
+		br->pos += (63 - br->count) >> 3;
+		br->count |= 56;
+		return;
+	}
+	while (br->count <= 56) {
+		br->buffer |= (uint64_t)bit_reader_byte(br) << br->count;
+		br->count += 8;
+	}
+}
+
+/*true once bits past the end of the last IDAT chunk have been consumed*/
+static int bit_reader_overrun(const bit_reader *br)
+{
+	return br->overrun * 8 > br->count;
+}
+
+static unsigned bit_reader_bits(bit_reader *br, unsigned nbits)
+{
+	unsigned result;
+	if (br->count < nbits) {
+		bit_reader_refill(br);
+	}
+	result = (unsigned)(br->buffer & ((1u << nbits) - 1));
+	br->buffer >>= nbits;
+	br->count -= nbits;
+	return result;
+}
+
+static unsigned reverse_bits(unsigned code, unsigned nbits)
+{
+	unsigned result = 0, i;
+	for (i = 0; i < nbits; i++) {
+		result = (result << 1) | ((code >> i) & 1);
+	}
+	return result;
+}
+
+/*build the lookup table of a canonical huffman code from its code lengths*/
+static void huffman_table_create(upng_t* upng, huffman_entry *table, const unsigned *bitlen, unsigned numcodes)
+{
+	unsigned blcount[MAX_BIT_LENGTH + 1];
+	unsigned nextcode[MAX_BIT_LENGTH + 1];
+	unsigned codes[MAX_SYMBOLS];
+	unsigned char sub_bits[1 << FAST_BITS];
+	unsigned n, len, next;
+	long left = 1;
+
+	memset(table, 0, sizeof(huffman_entry) * FAST_TABLE_SIZE);
+	memset(blcount, 0, sizeof(blcount));
+	memset(nextcode, 0, sizeof(nextcode));
+	memset(sub_bits, 0, sizeof(sub_bits));
+
+	for (n = 0; n < numcodes; n++) {
+		blcount[bitlen[n]]++;
+	}
+
+	/* reject oversubscribed codes, incomplete ones are fine as long as the missing codes never show up */
+	for (len = 1; len <= MAX_BIT_LENGTH; len++) {
+		left = (left << 1) - (long)blcount[len];
+		if (left < 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+	}
+
+	blcount[0] = 0;
+	for (len = 1; len <= MAX_BIT_LENGTH; len++) {
+		nextcode[len] = (nextcode[len - 1] + blcount[len - 1]) << 1;
+	}
+
+	/* codes are stored msb first but read lsb first, so the tables are indexed by the reversed code */
+	for (n = 0; n < numcodes; n++) {
+		len = bitlen[n];
+		if (len != 0) {
+			codes[n] = reverse_bits(nextcode[len]++, len);
+			if (len > FAST_BITS) {
+				unsigned prefix = codes[n] & ((1 << FAST_BITS) - 1);
+				if (len - FAST_BITS > sub_bits[prefix]) {
+					sub_bits[prefix] = (unsigned char)(len - FAST_BITS);
+				}
+			}
+		}
+	}
+
+	/* lay out the second level tables after the primary one */
+	next = 1 << FAST_BITS;
+	for (n = 0; n < (1 << FAST_BITS); n++) {
+		if (sub_bits[n] != 0) {
+			if (next + (1u << sub_bits[n]) > FAST_TABLE_SIZE) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+			table[n].value = (unsigned short)next;
+			table[n].sub_bits = sub_bits[n];
+			next += 1 << sub_bits[n];
+		}
+	}
+
+	/* every entry whose low bits match a code decodes to that code's symbol */
+	for (n = 0; n < numcodes; n++) {
+		unsigned i;
+		len = bitlen[n];
+		if (len == 0) {
+			continue;
+		}
+		if (len <= FAST_BITS) {
+			for (i = codes[n]; i < (1 << FAST_BITS); i += 1 << len) {
+				table[i].value = (unsigned short)n;
+				table[i].bits = (unsigned char)len;
+			}
+		} else {
+			const huffman_entry *link = &table[codes[n] & ((1 << FAST_BITS) - 1)];
+			unsigned remaining = len - FAST_BITS;
+			for (i = codes[n] >> FAST_BITS; i < (1u << link->sub_bits); i += 1 << remaining) {
+				table[link->value + i].value = (unsigned short)n;
+				table[link->value + i].bits = (unsigned char)remaining;
+			}
+		}
+	}
+}
+
+static unsigned huffman_table_decode_symbol(upng_t *upng, bit_reader *br, const huffman_entry *table)
+{
+	const huffman_entry *entry;
+
+	if (br->count < MAX_BIT_LENGTH) {
+		bit_reader_refill(br);
+	}
+
+	entry = &table[br->buffer & ((1 << FAST_BITS) - 1)];
+	if (entry->bits == 0) {
+		/* a code longer than FAST_BITS (or one that isn't part of the code at all) */
+		if (entry->sub_bits == 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return 0;
+		}
+		br->buffer >>= FAST_BITS;
+		br->count -= FAST_BITS;
+		entry = &table[entry->value + (unsigned)(br->buffer & ((1u << entry->sub_bits) - 1))];
+		if (entry->bits == 0) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return 0;
+		}
+	}
+
+	br->buffer >>= entry->bits;
+	br->count -= entry->bits;
+	return entry->value;
+}
+
+/* read the code length codes and code lengths of a dynamic block, then build both lookup tables */
+static void get_tables_inflate_dynamic(upng_t* upng, huffman_entry *codetable, huffman_entry *codetableD, bit_reader *br)
+{
+	huffman_entry codelengthtable[FAST_TABLE_SIZE];
+	unsigned codelengthcode[NUM_CODE_LENGTH_CODES];
+	unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS + NUM_DISTANCE_SYMBOLS];
+	unsigned hlit, hdist, hclen, i;
+
+	memset(bitlen, 0, sizeof(bitlen));
+
+	hlit = bit_reader_bits(br, 5) + 257;
+	hdist = bit_reader_bits(br, 5) + 1;
+	hclen = bit_reader_bits(br, 4) + 4;
+
+	for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
+		codelengthcode[CLCL[i]] = (i < hclen) ? bit_reader_bits(br, 3) : 0;
+	}
+
+	huffman_table_create(upng, codelengthtable, codelengthcode, NUM_CODE_LENGTH_CODES);
+	if (upng->error != UPNG_EOK) {
+		return;
+	}
+
+	/* literal/length and distance code lengths are one run-length coded sequence */
+	i = 0;
+	while (i < hlit + hdist) {
+		unsigned code = huffman_table_decode_symbol(upng, br, codelengthtable);
+		unsigned replength, value;
+
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+		if (bit_reader_overrun(br)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		if (code <= 15) {
+			bitlen[i++] = code;
+			continue;
+		} else if (code == 16) {	/*repeat previous 3-6 times */
+			if (i == 0) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+			replength = 3 + bit_reader_bits(br, 2);
+			value = bitlen[i - 1];
+		} else if (code == 17) {	/*repeat "0" 3-10 times */
+			replength = 3 + bit_reader_bits(br, 3);
+			value = 0;
+		} else {	/*repeat "0" 11-138 times */
+			replength = 11 + bit_reader_bits(br, 7);
+			value = 0;
+		}
+
+		if (i + replength > hlit + hdist) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+		while (replength-- > 0) {
+			bitlen[i++] = value;
+		}
+	}
+
+	/*the length of the end code 256 must be larger than 0 */
+	if (bitlen[256] == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	huffman_table_create(upng, codetable, bitlen, hlit);
+	if (upng->error == UPNG_EOK) {
+		huffman_table_create(upng, codetableD, bitlen + hlit, hdist);
+	}
+}
+
+/*unfilter every complete scanline sitting in the window and hand it to the row callback*/
+static void png_stream_flush(upng_t* upng, png_stream *stream)
+{
+	unsigned long window_size = stream->window_mask + 1;
+
+	while (stream->pos - stream->flushed >= stream->linebytes + 1) {
+		unsigned long start = stream->flushed & stream->window_mask;
+		const unsigned char *line = stream->window + start;
+		unsigned char *recon = stream->rows[stream->y & 1];
+		const unsigned char *precon = stream->y > 0 ? stream->rows[(stream->y - 1) & 1] : NULL;
+
+		if (start + stream->linebytes + 1 > window_size) {
+			/* the scanline wraps around the end of the window */
+			unsigned long first = window_size - start;
+			memcpy(stream->scanline, stream->window + start, first);
+			memcpy(stream->scanline + first, stream->window, stream->linebytes + 1 - first);
+			line = stream->scanline;
+		}
+
+		unfilter_scanline(upng, recon, line + 1, precon, stream->bytewidth, line[0], stream->linebytes);
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+
+		stream->callback(stream->user, stream->y, recon, stream->linebytes);
+		stream->y++;
+		stream->flushed += stream->linebytes + 1;
+	}
+}
+
+/*table driven counterpart of inflate_huffman, reading several bits per step from a 64-bit bit buffer*/
+static void inflate_huffman_stream(upng_t* upng, png_stream *stream, unsigned btype)
+{
+	huffman_entry codetable[FAST_TABLE_SIZE];
+	huffman_entry codetableD[FAST_TABLE_SIZE];
+	bit_reader *br = &stream->br;
+	unsigned char *window = stream->window;
+	unsigned long mask = stream->window_mask;
+
+	if (btype == 1) {
+		unsigned bitlen[NUM_DEFLATE_CODE_SYMBOLS];
+		unsigned bitlenD[NUM_DISTANCE_SYMBOLS];
+		unsigned i;
+
+		/* fixed trees, as given by the deflate specification */
+		for (i = 0; i < 144; i++) bitlen[i] = 8;
+		for (i = 144; i < 256; i++) bitlen[i] = 9;
+		for (i = 256; i < 280; i++) bitlen[i] = 7;
+		for (i = 280; i < NUM_DEFLATE_CODE_SYMBOLS; i++) bitlen[i] = 8;
+		for (i = 0; i < NUM_DISTANCE_SYMBOLS; i++) bitlenD[i] = 5;
+
+		huffman_table_create(upng, codetable, bitlen, NUM_DEFLATE_CODE_SYMBOLS);
+		huffman_table_create(upng, codetableD, bitlenD, NUM_DISTANCE_SYMBOLS);
+	} else {
+		get_tables_inflate_dynamic(upng, codetable, codetableD, br);
+	}
+
+	while (upng->error == UPNG_EOK) {
+		unsigned code = huffman_table_decode_symbol(upng, br, codetable);
+		if (upng->error != UPNG_EOK) {
+			return;
+		}
+		if (bit_reader_overrun(br)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		if (code <= 255) {
+			/* literal symbol */
+			if (stream->pos >= stream->total) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+			window[stream->pos++ & mask] = (unsigned char)code;
+		} else if (code == 256) {
+			/* end code */
+			return;
+		} else if (code <= LAST_LENGTH_CODE_INDEX) {
+			unsigned long length, distance, backward;
+			unsigned codeD;
+
+			length = LENGTH_BASE[code - FIRST_LENGTH_CODE_INDEX] + bit_reader_bits(br, LENGTH_EXTRA[code - FIRST_LENGTH_CODE_INDEX]);
+
+			codeD = huffman_table_decode_symbol(upng, br, codetableD);
+			if (upng->error != UPNG_EOK) {
+				return;
+			}
+			/* invalid distance code (30-31 are never used) */
+			if (codeD > 29) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+			distance = DISTANCE_BASE[codeD] + bit_reader_bits(br, DISTANCE_EXTRA[codeD]);
+
+			if (distance > stream->pos || stream->pos + length > stream->total || bit_reader_overrun(br)) {
+				SET_ERROR(upng, UPNG_EMALFORMED);
+				return;
+			}
+
+			/* byte by byte, the source may overlap the bytes being written */
+			backward = stream->pos - distance;
+			while (length-- > 0) {
+				window[stream->pos++ & mask] = window[backward++ & mask];
+			}
+		} else {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+
+		png_stream_flush(upng, stream);
+	}
+}
+
+static void inflate_uncompressed_stream(upng_t* upng, png_stream *stream)
+{
+	bit_reader *br = &stream->br;
+	unsigned len, nlen;
+
+	/* go to first boundary of byte */
+	bit_reader_bits(br, br->count & 7);
+
+	/* read len (2 bytes) and nlen (2 bytes) */
+	len = bit_reader_bits(br, 16);
+	nlen = bit_reader_bits(br, 16);
+
+	/* check if 16-bit nlen is really the one's complement of len */
+	if (len + nlen != 65535 || stream->pos + len > stream->total) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return;
+	}
+
+	/* the literal data: first the whole bytes still in the bit buffer, then straight from the chunks;
+	   at most 258 bytes go in between two flushes, like a match, so the window never overflows */
+	while (len > 0 && upng->error == UPNG_EOK) {
+		unsigned n = len < 258 ? len : 258;
+		len -= n;
+		while (n-- > 0) {
+			if (br->count >= 8) {
+				stream->window[stream->pos++ & stream->window_mask] = (unsigned char)bit_reader_bits(br, 8);
+			} else {
+				br->buffer = 0;
+				br->count = 0;
+				stream->window[stream->pos++ & stream->window_mask] = bit_reader_byte(br);
+			}
+		}
+		if (bit_reader_overrun(br)) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+			return;
+		}
+		png_stream_flush(upng, stream);
+	}
+}
+
+/*inflate the zlib stream of the IDAT chunks and unfilter it on the fly; returns the error*/
+static upng_error png_stream_decode(upng_t* upng, upng_row_callback callback, void *user)
+{
+	png_stream stream;
+	unsigned long window_size = 1;
+	unsigned bpp = upng_get_bpp(upng);
+	unsigned cmf, flg, done = 0;
+
+	if (bpp == 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+		return upng->error;
+	}
+
+	stream.linebytes = (upng->width * bpp + 7) / 8;
+	stream.bytewidth = (bpp + 7) / 8;
+	stream.total = (stream.linebytes + 1) * upng->height;
+	stream.pos = 0;
+	stream.flushed = 0;
+	stream.y = 0;
+	stream.callback = callback;
+	stream.user = user;
+
+	/* room for the 32k deflate history, a pending scanline and one more match */
+	while (window_size < 32768 + stream.linebytes + 1 + 258) {
+		window_size <<= 1;
+	}
+	stream.window_mask = window_size - 1;
+
+	stream.window = (unsigned char*)malloc(window_size + 3 * (stream.linebytes + 1));
+	if (stream.window == NULL) {
+		SET_ERROR(upng, UPNG_ENOMEM);
+		return upng->error;
+	}
+	stream.rows[0] = stream.window + window_size;
+	stream.rows[1] = stream.rows[0] + stream.linebytes + 1;
+	stream.scanline = stream.rows[1] + stream.linebytes + 1;
+
+	bit_reader_init(&stream.br, upng->source.buffer, upng->source.size);
+
+	/* zlib header: 256 * cmf + flg must be a multiple of 31, compression method 8 with a window of at most 32k,
+	   and no preset dictionary, which the PNG specification forbids */
+	cmf = bit_reader_bits(&stream.br, 8);
+	flg = bit_reader_bits(&stream.br, 8);
+	if (bit_reader_overrun(&stream.br) || (cmf * 256 + flg) % 31 != 0 || (cmf & 15) != 8 || ((cmf >> 4) & 15) > 7 || ((flg >> 5) & 1) != 0) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+
+	while (done == 0 && upng->error == UPNG_EOK) {
+		unsigned btype;
+
+		/* read block control bits */
+		done = bit_reader_bits(&stream.br, 1);
+		btype = bit_reader_bits(&stream.br, 2);
+		if (bit_reader_overrun(&stream.br) || btype == 3) {
+			SET_ERROR(upng, UPNG_EMALFORMED);
+		} else if (btype == 0) {
+			inflate_uncompressed_stream(upng, &stream);
+		} else {
+			inflate_huffman_stream(upng, &stream, btype);
+		}
+	}
+
+	/* every scanline must have been there */
+	if (upng->error == UPNG_EOK && stream.y != upng->height) {
+		SET_ERROR(upng, UPNG_EMALFORMED);
+	}
+
+	free(stream.window);
+	return upng->error;
+}
+
+/*row callback of upng_decode, storing each scanline in the image buffer*/
+static void store_row(void *user, unsigned y, const unsigned char *row, unsigned long size)
+{
+	upng_t *upng = (upng_t*)user;
+	unsigned long olinebits = upng->width * upng_get_bpp(upng);
+
+	if (olinebits % 8 == 0) {
+		memcpy(upng->buffer + y * size, row, size);
+	} else {
+		/* scanlines of less than 8 bits per pixel are packed without their padding bits */
+		unsigned long obp = y * olinebits, ibp;
+		for (ibp = 0; ibp < olinebits; ibp++, obp++) {
+			unsigned char bit = (unsigned char)((row[ibp >> 3] >> (7 - (ibp & 0x7))) & 1);
+			if (bit == 0)
+				upng->buffer[obp >> 3] &= (unsigned char)(~(1 << (7 - (obp & 0x7))));
+			else
+				upng->buffer[obp >> 3] |= (1 << (7 - (obp & 0x7)));
+		}
+	}
+}
+
 static upng_format determine_format(upng_t* upng) {
 	switch (upng->color_type) {
 	case UPNG_LUM:
@@ -960,30 +1649,25 @@ upng_error upng_header(upng_t* upng)
 	return upng->error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-upng_error upng_decode(upng_t* upng)
+/*check the state and the chunks ahead of a decode; returns 1 when the image data is ready to be decoded*/
+static int upng_decode_prepare(upng_t* upng, unsigned long *compressed_size)
 {
 	const unsigned char *chunk;
-	unsigned char* compressed;
-	unsigned char* inflated;
-	unsigned long compressed_size = 0, compressed_index = 0;
-	unsigned long inflated_size;
-	upng_error error;
 
 	/* if we have an error state, bail now */
 	if (upng->error != UPNG_EOK) {
-		return upng->error;
+		return 0;
 	}
 
 	/* parse the main header, if necessary */
 	upng_header(upng);
 	if (upng->error != UPNG_EOK) {
-		return upng->error;
+		return 0;
 	}
 
 	/* if the state is not HEADER (meaning we are ready to decode the image), stop now */
 	if (upng->state != UPNG_HEADER) {
-		return upng->error;
+		return 0;
 	}
 
 	/* release old result, if any */
@@ -995,53 +1679,63 @@ upng_error upng_decode(upng_t* upng)
 
 	/* first byte of the first chunk after the header */
 	chunk = upng->source.buffer + 33;
+	*compressed_size = 0;
 
 	/* scan through the chunks, finding the size of all IDAT chunks, and also
 	 * verify general well-formed-ness */
 	while (chunk < upng->source.buffer + upng->source.size) {
 		unsigned long length;
-		const unsigned char *data;	/*the data in the chunk */
 
 		/* make sure chunk header is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return 0;
 		}
 
 		/* get length; sanity check it */
 		length = upng_chunk_length(chunk);
 		if (length > INT_MAX) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return 0;
 		}
 
 		/* make sure chunk header+paylaod is not larger than the total compressed */
 		if ((unsigned long)(chunk - upng->source.buffer + length + 12) > upng->source.size) {
 			SET_ERROR(upng, UPNG_EMALFORMED);
-			return upng->error;
+			return 0;
 		}
 
-		/* get pointer to payload */
-		data = chunk + 8;
-
 		/* parse chunks */
 		if (upng_chunk_type(chunk) == CHUNK_IDAT) {
-			compressed_size += length;
+			*compressed_size += length;
 		} else if (upng_chunk_type(chunk) == CHUNK_IEND) {
 			break;
 		} else if (upng_chunk_critical(chunk)) {
 			SET_ERROR(upng, UPNG_EUNSUPPORTED);
-			return upng->error;
+			return 0;
 		}
 
 		chunk += upng_chunk_length(chunk) + 12;
 	}
 
+	return 1;
+}
+
+/*original decoder: gather the IDAT chunks, inflate everything, then unfilter everything into upng->buffer*/
+static void upng_decode_buffered(upng_t* upng, unsigned long compressed_size)
+{
+	const unsigned char *chunk;
+	unsigned char* compressed;
+	unsigned char* inflated;
+	unsigned long compressed_index = 0;
+	unsigned long inflated_size;
+	upng_error error;
+
 	/* allocate enough space for the (compressed and filtered) image data */
 	compressed = (unsigned char*)malloc(compressed_size);
 	if (compressed == NULL) {
 		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+		return;
 	}
 
 	/* scan through the chunks again, this time copying the values into
@@ -1071,7 +1765,7 @@ upng_error upng_decode(upng_t* upng)
 	if (inflated == NULL) {
 		free(compressed);
 		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+		return;
 	}
 
 	/* decompress image data */
@@ -1079,7 +1773,7 @@ upng_error upng_decode(upng_t* upng)
 	if (error != UPNG_EOK) {
 		free(compressed);
 		free(inflated);
-		return upng->error;
+		return;
 	}
 
 	/* free the compressed compressed data */
@@ -1092,7 +1786,7 @@ upng_error upng_decode(upng_t* upng)
 		free(inflated);
 		upng->size = 0;
 		SET_ERROR(upng, UPNG_ENOMEM);
-		return upng->error;
+		return;
 	}
 
 	/* unfilter scanlines */
@@ -1103,7 +1797,97 @@ upng_error upng_decode(upng_t* upng)
 		free(upng->buffer);
 		upng->buffer = NULL;
 		upng->size = 0;
+	}
+}
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
+upng_error upng_decode(upng_t* upng)
+{
+	unsigned long compressed_size;
+
+	if (!upng_decode_prepare(upng, &compressed_size)) {
+		return upng->error;
+	}
+
+	if (upng->flags & UPNG_FLAG_BITWISE_INFLATE) {
+		upng_decode_buffered(upng, compressed_size);
+	} else {
+		/* allocate final image buffer, the scanlines are stored in it as they come out of the stream */
+		upng->size = (upng->height * upng->width * upng_get_bpp(upng) + 7) / 8;
+		upng->buffer = (unsigned char*)malloc(upng->size);
+		if (upng->buffer == NULL) {
+			upng->size = 0;
+			SET_ERROR(upng, UPNG_ENOMEM);
+			return upng->error;
+		}
+
+		if (png_stream_decode(upng, store_row, upng) != UPNG_EOK) {
+			free(upng->buffer);
+			upng->buffer = NULL;
+			upng->size = 0;
+		}
+	}
+
+	if (upng->error == UPNG_EOK) {
+		upng->state = UPNG_DECODED;
+	}
+
+	/* we are done with our input buffer; free it if we own it */
+	upng_free_source(upng);
+
+	return upng->error;
+}
+
+/*decode a PNG one scanline at a time without keeping the image; upng_get_buffer stays empty afterwards*/
+upng_error upng_decode_rows(upng_t* upng, upng_row_callback callback, void* user)
+{
+	unsigned long compressed_size;
+
+	if (callback == NULL) {
+		SET_ERROR(upng, UPNG_EPARAM);
+		return upng->error;
+	}
+
+	if (!upng_decode_prepare(upng, &compressed_size)) {
+		return upng->error;
+	}
+
+	if (upng->flags & UPNG_FLAG_BITWISE_INFLATE) {
+		/* decode the whole image the old way, then hand its scanlines out padded to whole bytes again */
+		upng_decode_buffered(upng, compressed_size);
+		if (upng->error == UPNG_EOK) {
+			unsigned long olinebits = upng->width * upng_get_bpp(upng);
+			unsigned long linebytes = (olinebits + 7) / 8;
+			unsigned char *row = (unsigned char*)malloc(linebytes);
+			unsigned y;
+
+			if (row == NULL) {
+				SET_ERROR(upng, UPNG_ENOMEM);
+			} else {
+				for (y = 0; y < upng->height; y++) {
+					if (olinebits % 8 == 0) {
+						memcpy(row, upng->buffer + y * linebytes, linebytes);
+					} else {
+						unsigned long ibp = y * olinebits, obp;
+						memset(row, 0, linebytes);
+						for (obp = 0; obp < olinebits; obp++, ibp++) {
+							row[obp >> 3] |= (unsigned char)(((upng->buffer[ibp >> 3] >> (7 - (ibp & 0x7))) & 1) << (7 - (obp & 0x7)));
+						}
+					}
+					callback(user, y, row, linebytes);
+				}
+				free(row);
+			}
+
+			free(upng->buffer);
+			upng->buffer = NULL;
+			upng->size = 0;
+		}
 	} else {
+		png_stream_decode(upng, callback, user);
+	}
+
+	if (upng->error == UPNG_EOK) {
 		upng->state = UPNG_DECODED;
 	}
 
@@ -1140,6 +1924,8 @@ static upng_t* upng_new(void)
 	upng->source.size = 0;
 	upng->source.owning = 0;
 
+	upng->flags = UPNG_FLAG_NONE;
+
 	return upng;
 }
 
@@ -1213,6 +1999,11 @@ void upng_free(upng_t* upng)
 	free(upng);
 }
 
+void upng_set_flags(upng_t* upng, unsigned flags)
+{
+	upng->flags = flags;
+}
+
 upng_error upng_get_error(const upng_t* upng)
 {
 	return upng->error;
@@ -55,14 +55,25 @@ typedef enum upng_format {
 	UPNG_LUMINANCE_ALPHA8
 } upng_format;
 
+typedef enum upng_flags {
+	UPNG_FLAG_NONE				= 0,
+	UPNG_FLAG_BITWISE_INFLATE	= 1, /* walk the Huffman trees one bit at a time instead of using lookup tables */
+	UPNG_FLAG_SCALAR_UNFILTER	= 2  /* unfilter scanlines byte by byte even where SSE2/AVX2 code exists */
+} upng_flags;
+
 typedef struct upng_t upng_t;
 
+/* receives one unfiltered scanline at a time, padded to whole bytes; row is only valid during the call */
+typedef void (*upng_row_callback)(void* user, unsigned y, const unsigned char* row, unsigned long size);
+
 upng_t*		upng_new_from_bytes	(const unsigned char* buffer, unsigned long size);
 upng_t*		upng_new_from_file	(const char* path);
 void		upng_free			(upng_t* upng);
+void		upng_set_flags		(upng_t* upng, unsigned flags);
 
 upng_error	upng_header			(upng_t* upng);
 upng_error	upng_decode			(upng_t* upng);
+upng_error	upng_decode_rows	(upng_t* upng, upng_row_callback callback, void* user);
 
 upng_error	upng_get_error		(const upng_t* upng);
 unsigned	upng_get_error_line	(const upng_t* upng);
@@ -1,4 +1,5 @@
 #include "vector.h"
+#include "simd_math.h"
 #include <math.h>
 
 ////////////////////////////////////////////////////////////
@@ -8,11 +9,13 @@ float vec2_length(vec2_t v) {
 	return sqrt(v.x * v.x + v.y * v.y);
 }
 vec2_t vec2_add(vec2_t a, vec2_t b) {
-	vec2_t result = { .x = a.x + b.x, .y = a.y + b.y };
+	vec2_t result;
+	vec2_add_ref(&result, &a, &b);
 	return result;
 }
 vec2_t vec2_sub(vec2_t a, vec2_t b) {
-	vec2_t result = { .x = a.x - b.x, .y = a.y - b.y };
+	vec2_t result;
+	vec2_sub_ref(&result, &a, &b);
 	return result;
 }
 vec2_t vec2_mul(vec2_t v, float factor) {
@@ -24,7 +27,7 @@ vec2_t vec2_div(vec2_t v, float factor) {
 	return result;
 }
 float vec2_dot(vec2_t a, vec2_t b) {
-	return (a.x * b.x) + (a.y * b.y);
+	return vec2_dot_ref(&a, &b);
 }
 void vec2_normalize(vec2_t* v) {
 	float length = sqrt(v->x * v->x + v->y * v->y);
@@ -36,18 +39,21 @@ void vec2_normalize(vec2_t* v) {
 // Vector 3D functions
 ////////////////////////////////////////////////////////////
 float vec3_length(vec3_t v) {
-	return sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+	return vec3_length_ref(&v);
 }
 vec3_t vec3_add(vec3_t a, vec3_t b) {
-	vec3_t result = { .x = a.x + b.x, .y = a.y + b.y, .z = a.z + b.z };
+	vec3_t result;
+	vec3_add_ref(&result, &a, &b);
 	return result;
 }
 vec3_t vec3_sub(vec3_t a, vec3_t b) {
-	vec3_t result = { .x = a.x - b.x, .y = a.y - b.y, .z = a.z - b.z };
+	vec3_t result;
+	vec3_sub_ref(&result, &a, &b);
 	return result;
 }
 vec3_t vec3_mul(vec3_t v, float factor) {
-	vec3_t result = { .x = v.x * factor, .y = v.y * factor, .z = v.z * factor };
+	vec3_t result;
+	vec3_mul_ref(&result, &v, factor);
 	return result;
 }
 vec3_t vec3_div(vec3_t v, float factor) {
@@ -55,23 +61,17 @@ vec3_t vec3_div(vec3_t v, float factor) {
 	return result;
 }
 vec3_t vec3_cross(vec3_t a, vec3_t b) {
-	vec3_t result = {
-		.x = a.y * b.z - a.z * b.y,
-		.y = a.z * b.x - a.x * b.z,
-		.z = a.x * b.y - a.y * b.x
-	};
+	vec3_t result;
+	vec3_cross_ref(&result, &a, &b);
 	return result;
 }
 
 void vec3_normalize(vec3_t* v) {
-	float length = sqrt(v->x * v->x + v->y * v->y + v->z * v->z);
-	v->x /= length;
-	v->y /= length;
-	v->z /= length;
+	vec3_normalize_ref(v);
 }
 
 float vec3_dot(vec3_t a, vec3_t b) {
-	return (a.x * b.x) + (a.y * b.y) + (a.z * b.z);
+	return vec3_dot_ref(&a, &b);
 }
 
 vec3_t vec3_rotate_x(vec3_t v, float angle) {
@@ -105,16 +105,58 @@ vec3_t vec3_rotate_z(vec3_t v, float angle) {
 // Vector conversion functions
 ////////////////////////////////////////////////////////////
 vec4_t vec4_from_vec3(vec3_t v) {
-	vec4_t result = { v.x, v.y, v.z, 1.0 };
+	vec4_t result;
+	vec4_from_vec3_ref(&result, &v);
 	return result;
 }
 
 vec3_t vec3_from_vec4(vec4_t v) {
-	vec3_t result = { v.x, v.y, v.z };
+	vec3_t result;
+	vec3_from_vec4_ref(&result, &v);
 	return result;
 }
 
 vec2_t vec2_from_vec4(vec4_t v) {
-	vec2_t result = { v.x, v.y };
+	vec2_t result;
+	vec2_from_vec4_ref(&result, &v);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// Quaternion functions
+////////////////////////////////////////////////////////////
+quat_t quat_identity(void) {
+	quat_t result = { 0, 0, 0, 1 };
 	return result;
-}
\ No newline at end of file
+}
+
+// Rotation of angle radians around a unit axis
+quat_t quat_from_axis_angle(vec3_t axis, float angle) {
+	float s = sin(angle / 2);
+	quat_t result = { axis.x * s, axis.y * s, axis.z * s, cos(angle / 2) };
+	return result;
+}
+
+// Rotation around x, then y, then z, like the product of the rotation matrices
+quat_t quat_from_euler(vec3_t angles) {
+	quat_t qx = quat_from_axis_angle((vec3_t){ 1, 0, 0 }, angles.x);
+	quat_t qy = quat_from_axis_angle((vec3_t){ 0, 1, 0 }, angles.y);
+	quat_t qz = quat_from_axis_angle((vec3_t){ 0, 0, 1 }, angles.z);
+	return quat_mul(qz, quat_mul(qy, qx));
+}
+
+// The rotation b followed by the rotation a
+quat_t quat_mul(quat_t a, quat_t b) {
+	quat_t result;
+	quat_mul_ref(&result, &a, &b);
+	return result;
+}
+
+// Bring a quaternion back to unit length after it has been multiplied many times
+void quat_normalize(quat_t* q) {
+	float length = sqrt(q->x * q->x + q->y * q->y + q->z * q->z + q->w * q->w);
+	q->x /= length;
+	q->y /= length;
+	q->z /= length;
+	q->w /= length;
+}
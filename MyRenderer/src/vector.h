@@ -13,6 +13,11 @@ typedef struct {
 	float x, y, z, w;
 } vec4_t;
 
+// Orientation as a unit quaternion, x y z is the vector part and w the scalar part
+typedef struct {
+	float x, y, z, w;
+} quat_t;
+
 ////////////////////////////////////////////////////////////
 // Vector 2D functions
 ////////////////////////////////////////////////////////////
@@ -47,4 +52,13 @@ vec4_t vec4_from_vec3(vec3_t v);
 vec3_t vec3_from_vec4(vec4_t v);
 vec2_t vec2_from_vec4(vec4_t v);
 
+////////////////////////////////////////////////////////////
+// Quaternion functions
+////////////////////////////////////////////////////////////
+quat_t quat_identity(void);
+quat_t quat_from_axis_angle(vec3_t axis, float angle);
+quat_t quat_from_euler(vec3_t angles);
+quat_t quat_mul(quat_t a, quat_t b);
+void quat_normalize(quat_t* q);
+
 #endif
\ No newline at end of file
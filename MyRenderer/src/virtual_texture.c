@@ -0,0 +1,534 @@
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "virtual_texture.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// A virtual texture keeps its mip chain in a page file, cut in square pages of
+// VIRTUAL_PAGE_SIZE texels, and only holds the pages drawing asks for. The
+// rasterizer records the pages it misses, a loader thread reads them from the
+// file, and between frames they replace the least recently used cache slots.
+// Until a page arrives, sampling falls back to the next coarser level that is
+// resident; the levels that fit in a single page always are.
+///////////////////////////////////////////////////////////////////////////////
+#define VIRTUAL_TEXTURE_MAGIC 0x58455456 // "VTEX"
+#define VIRTUAL_TEXTURE_VERSION 1
+#define VIRTUAL_TEXTURE_ALIGNMENT 64
+#define VIRTUAL_PAGE_TEXELS (VIRTUAL_PAGE_SIZE * VIRTUAL_PAGE_SIZE)
+#define VIRTUAL_PAGE_BYTES (VIRTUAL_PAGE_TEXELS * sizeof(uint32_t))
+#define LOADER_MAX_IN_FLIGHT 64
+
+enum {
+	page_missing,
+	page_queued,
+	page_resident
+};
+
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t pages_x;
+	uint32_t pages_y;
+	uint32_t first_page;
+} virtual_file_mip_t;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t source_hash; // hash of the png bytes the pages were decoded from
+	uint32_t page_size;
+	uint32_t num_mips;
+	uint32_t num_pages;
+	virtual_file_mip_t mips[MAX_MIP_LEVELS];
+} virtual_file_header_t;
+
+int virtual_texture_threshold = 4096;
+int virtual_texture_cache_pages = 256;
+
+static long page_data_offset(void) {
+	return (sizeof(virtual_file_header_t) + VIRTUAL_TEXTURE_ALIGNMENT - 1) & ~(long)(VIRTUAL_TEXTURE_ALIGNMENT - 1);
+}
+
+// Sizes and page counts of the same mip chain texture_generate_mipmaps builds
+static int virtual_mip_chain(virtual_mip_t* mips, int width, int height) {
+	int num_mips = 0;
+	int first_page = 0;
+	while (num_mips < MAX_MIP_LEVELS) {
+		virtual_mip_t* mip = &mips[num_mips++];
+		mip->width = width;
+		mip->height = height;
+		mip->pages_x = (width + VIRTUAL_PAGE_SIZE - 1) / VIRTUAL_PAGE_SIZE;
+		mip->pages_y = (height + VIRTUAL_PAGE_SIZE - 1) / VIRTUAL_PAGE_SIZE;
+		mip->first_page = first_page;
+		first_page += mip->pages_x * mip->pages_y;
+		if (width == 1 && height == 1)
+			break;
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+	}
+	return num_mips;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Page file builder. Scanlines come out of the png decoder one at a time; each
+// level gathers a strip of VIRTUAL_PAGE_SIZE rows, written out as pages once
+// full, and every second row is box filtered with the one before into a row of
+// the next level. Only one strip per level is ever held in memory.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	FILE* file;
+	int num_mips;
+	virtual_mip_t mips[MAX_MIP_LEVELS];
+	uint32_t* strips[MAX_MIP_LEVELS]; // VIRTUAL_PAGE_SIZE rows of each level
+	uint32_t* rows[MAX_MIP_LEVELS];   // row being handed to each level
+	uint32_t* page;
+	int components;
+	int bitdepth;
+	bool ok;
+} page_builder_t;
+
+static void builder_write_strip(page_builder_t* builder, int level, int strip_y, int num_rows) {
+	const virtual_mip_t* mip = &builder->mips[level];
+	const uint32_t* strip = builder->strips[level];
+
+	for (int page_x = 0; page_x < mip->pages_x && builder->ok; page_x++) {
+		int x0 = page_x * VIRTUAL_PAGE_SIZE;
+		int columns = mip->width - x0 < VIRTUAL_PAGE_SIZE ? mip->width - x0 : VIRTUAL_PAGE_SIZE;
+
+		// Pages past the right and bottom borders are padded with zeros
+		memset(builder->page, 0, VIRTUAL_PAGE_BYTES);
+		for (int row = 0; row < num_rows; row++) {
+			memcpy(builder->page + row * VIRTUAL_PAGE_SIZE, strip + row * mip->width + x0, columns * sizeof(uint32_t));
+		}
+
+		long page = mip->first_page + strip_y * mip->pages_x + page_x;
+		builder->ok =
+			fseek(builder->file, page_data_offset() + page * (long)VIRTUAL_PAGE_BYTES, SEEK_SET) == 0 &&
+			fwrite(builder->page, VIRTUAL_PAGE_BYTES, 1, builder->file) == 1;
+	}
+}
+
+static void builder_add_row(page_builder_t* builder, int level, int y, const uint32_t* colors) {
+	const virtual_mip_t* mip = &builder->mips[level];
+	uint32_t* strip = builder->strips[level];
+	int strip_row = y % VIRTUAL_PAGE_SIZE;
+
+	memcpy(strip + strip_row * mip->width, colors, mip->width * sizeof(uint32_t));
+	if (strip_row == VIRTUAL_PAGE_SIZE - 1 || y == mip->height - 1)
+		builder_write_strip(builder, level, y / VIRTUAL_PAGE_SIZE, strip_row + 1);
+
+	// Rows 2y and 2y+1 make row y of the next level, a single row is used twice
+	if (level + 1 < builder->num_mips && (y % 2 == 1 || mip->height == 1)) {
+		const uint32_t* row0 = strip + (mip->height == 1 ? strip_row : strip_row - 1) * mip->width;
+		const uint32_t* row1 = strip + strip_row * mip->width;
+		uint32_t* next_row = builder->rows[level + 1];
+		for (int x = 0; x < builder->mips[level + 1].width; x++) {
+			int x0 = x * 2;
+			int x1 = (x0 + 1 < mip->width) ? x0 + 1 : x0;
+			next_row[x] = color_box_filter(row0[x0], row0[x1], row1[x0], row1[x1]);
+		}
+		builder_add_row(builder, level + 1, y / 2, next_row);
+	}
+}
+
+static void store_page_row(void* user, unsigned y, const unsigned char* row, unsigned long size) {
+	page_builder_t* builder = (page_builder_t*)user;
+	int width = builder->mips[0].width;
+	if (!builder->ok || size * 8 < (unsigned long)width * builder->components * builder->bitdepth)
+		return;
+
+	for (int x = 0; x < width; x++) {
+		builder->rows[0][x] = png_row_color(row, x, builder->components, builder->bitdepth);
+	}
+	builder_add_row(builder, 0, (int)y, builder->rows[0]);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decode a png whose header was read into a page file with its whole mip chain
+///////////////////////////////////////////////////////////////////////////////
+bool virtual_texture_build(const char* pages_path, uint64_t source_hash, upng_t* png) {
+	page_builder_t builder;
+	memset(&builder, 0, sizeof(builder));
+	builder.num_mips = virtual_mip_chain(builder.mips, upng_get_width(png), upng_get_height(png));
+	builder.components = upng_get_components(png);
+	builder.bitdepth = upng_get_bitdepth(png);
+	builder.ok = upng_get_format(png) != UPNG_BADFORMAT;
+
+	builder.page = (uint32_t*)malloc(VIRTUAL_PAGE_BYTES);
+	builder.ok = builder.ok && builder.page != NULL;
+	for (int i = 0; i < builder.num_mips && builder.ok; i++) {
+		builder.strips[i] = (uint32_t*)malloc(sizeof(uint32_t) * builder.mips[i].width * VIRTUAL_PAGE_SIZE);
+		builder.rows[i] = (uint32_t*)malloc(sizeof(uint32_t) * builder.mips[i].width);
+		builder.ok = builder.strips[i] != NULL && builder.rows[i] != NULL;
+	}
+
+	virtual_file_header_t header;
+	memset(&header, 0, sizeof(header));
+	header.magic = VIRTUAL_TEXTURE_MAGIC;
+	header.version = VIRTUAL_TEXTURE_VERSION;
+	header.source_hash = source_hash;
+	header.page_size = VIRTUAL_PAGE_SIZE;
+	header.num_mips = builder.num_mips;
+	for (int i = 0; i < builder.num_mips; i++) {
+		header.mips[i].width = builder.mips[i].width;
+		header.mips[i].height = builder.mips[i].height;
+		header.mips[i].pages_x = builder.mips[i].pages_x;
+		header.mips[i].pages_y = builder.mips[i].pages_y;
+		header.mips[i].first_page = builder.mips[i].first_page;
+		header.num_pages += builder.mips[i].pages_x * builder.mips[i].pages_y;
+	}
+
+	if (builder.ok && fopen_s(&builder.file, pages_path, "wb") == 0 && builder.file != NULL) {
+		builder.ok = fwrite(&header, sizeof(header), 1, builder.file) == 1;
+		if (builder.ok && upng_decode_rows(png, store_page_row, &builder) != UPNG_EOK)
+			builder.ok = false;
+		fclose(builder.file);
+
+		// Never leave a half written page file behind
+		if (!builder.ok)
+			remove(pages_path);
+	} else {
+		builder.ok = false;
+	}
+
+	for (int i = 0; i < builder.num_mips; i++) {
+		free(builder.strips[i]);
+		free(builder.rows[i]);
+	}
+	free(builder.page);
+	return builder.ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Loader thread. It only reads page texels from the files into new buffers;
+// the page tables and cache slots are touched by the main thread alone.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+	virtual_texture_t* texture;
+	int page;
+	uint32_t* texels; // NULL until loaded, and when the read failed
+} page_load_t;
+
+static SDL_Thread* loader_thread = NULL;
+static SDL_mutex* loader_mutex = NULL;
+static SDL_cond* loader_wake = NULL;          // signaled when loads are queued or on shutdown
+static SDL_cond* loader_idle = NULL;          // signaled when a load is done
+static page_load_t loader_queue[LOADER_MAX_IN_FLIGHT];
+static page_load_t loader_done[LOADER_MAX_IN_FLIGHT];
+static int loader_queue_count = 0;
+static int loader_done_count = 0;
+static virtual_texture_t* loader_current = NULL; // texture of the page being read
+static bool loader_quit = false;
+
+static virtual_texture_t* open_textures[MAX_TEXTURES];
+static int num_open_textures = 0;
+
+static int loader_run(void* data) {
+	SDL_LockMutex(loader_mutex);
+	while (!loader_quit) {
+		if (loader_queue_count == 0) {
+			SDL_CondWait(loader_wake, loader_mutex);
+			continue;
+		}
+
+		page_load_t load = loader_queue[0];
+		memmove(loader_queue, loader_queue + 1, sizeof(page_load_t) * --loader_queue_count);
+		loader_current = load.texture;
+		SDL_UnlockMutex(loader_mutex);
+
+		load.texels = (uint32_t*)malloc(VIRTUAL_PAGE_BYTES);
+		long offset = load.texture->data_offset + load.page * (long)VIRTUAL_PAGE_BYTES;
+		if (load.texels != NULL &&
+			(fseek(load.texture->file, offset, SEEK_SET) != 0 ||
+			fread(load.texels, VIRTUAL_PAGE_BYTES, 1, load.texture->file) != 1)) {
+			free(load.texels);
+			load.texels = NULL;
+		}
+
+		SDL_LockMutex(loader_mutex);
+		loader_done[loader_done_count++] = load;
+		loader_current = NULL;
+		SDL_CondBroadcast(loader_idle);
+	}
+	SDL_UnlockMutex(loader_mutex);
+	return 0;
+}
+
+static bool loader_start(void) {
+	if (loader_thread != NULL)
+		return true;
+
+	loader_mutex = SDL_CreateMutex();
+	loader_wake = SDL_CreateCond();
+	loader_idle = SDL_CreateCond();
+	loader_quit = false;
+	if (loader_mutex != NULL && loader_wake != NULL && loader_idle != NULL)
+		loader_thread = SDL_CreateThread(loader_run, "virtual texture loader", NULL);
+	if (loader_thread == NULL) {
+		virtual_texture_shutdown();
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Stop the loader thread once no virtual texture is left
+///////////////////////////////////////////////////////////////////////////////
+void virtual_texture_shutdown(void) {
+	if (loader_thread != NULL) {
+		SDL_LockMutex(loader_mutex);
+		loader_quit = true;
+		SDL_CondSignal(loader_wake);
+		SDL_UnlockMutex(loader_mutex);
+		SDL_WaitThread(loader_thread, NULL);
+		loader_thread = NULL;
+	}
+	for (int i = 0; i < loader_done_count; i++) {
+		free(loader_done[i].texels);
+	}
+	loader_queue_count = 0;
+	loader_done_count = 0;
+
+	if (loader_idle != NULL)
+		SDL_DestroyCond(loader_idle);
+	if (loader_wake != NULL)
+		SDL_DestroyCond(loader_wake);
+	if (loader_mutex != NULL)
+		SDL_DestroyMutex(loader_mutex);
+	loader_idle = NULL;
+	loader_wake = NULL;
+	loader_mutex = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Open a page file built from the same png bytes and load its pinned levels.
+// Returns NULL when the file is missing, stale or can not be read.
+///////////////////////////////////////////////////////////////////////////////
+virtual_texture_t* virtual_texture_open(const char* pages_path, uint64_t source_hash) {
+	if (num_open_textures == MAX_TEXTURES || !loader_start())
+		return NULL;
+
+	FILE* file;
+	if (fopen_s(&file, pages_path, "rb") != 0 || file == NULL)
+		return NULL;
+
+	virtual_file_header_t header;
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+		header.magic != VIRTUAL_TEXTURE_MAGIC ||
+		header.version != VIRTUAL_TEXTURE_VERSION ||
+		header.source_hash != source_hash ||
+		header.page_size != VIRTUAL_PAGE_SIZE ||
+		header.num_mips == 0 || header.num_mips > MAX_MIP_LEVELS) {
+		fclose(file);
+		return NULL;
+	}
+
+	virtual_texture_t* texture = (virtual_texture_t*)calloc(1, sizeof(virtual_texture_t));
+	if (texture == NULL) {
+		fclose(file);
+		return NULL;
+	}
+	texture->file = file;
+	texture->data_offset = page_data_offset();
+	texture->num_mips = virtual_mip_chain(texture->mips, header.mips[0].width, header.mips[0].height);
+	texture->num_pages = texture->mips[texture->num_mips - 1].first_page + 1;
+
+	bool ok = texture->num_mips == (int)header.num_mips && texture->num_pages == (int)header.num_pages;
+
+	// Every level that fits in one page stays resident, in the first slots
+	int first_pinned_level = texture->num_mips - 1;
+	while (first_pinned_level > 0 &&
+		texture->mips[first_pinned_level - 1].pages_x * texture->mips[first_pinned_level - 1].pages_y == 1) {
+		first_pinned_level--;
+	}
+	texture->num_pinned_slots = texture->num_mips - first_pinned_level;
+	texture->num_slots = texture->num_pinned_slots + virtual_texture_cache_pages;
+
+	texture->pages = (virtual_page_t*)malloc(sizeof(virtual_page_t) * texture->num_pages);
+	texture->slot_texels = (uint32_t*)malloc(VIRTUAL_PAGE_BYTES * texture->num_slots);
+	texture->slot_page = (int*)malloc(sizeof(int) * texture->num_slots);
+	texture->slot_last_used = (SDL_atomic_t*)calloc(texture->num_slots, sizeof(SDL_atomic_t));
+	ok = ok && texture->pages != NULL && texture->slot_texels != NULL && texture->slot_page != NULL && texture->slot_last_used != NULL;
+
+	for (int i = 0; ok && i < texture->num_pages; i++) {
+		texture->pages[i].slot = -1;
+		SDL_AtomicSet(&texture->pages[i].state, page_missing);
+	}
+	for (int i = 0; ok && i < texture->num_slots; i++) {
+		texture->slot_page[i] = -1;
+	}
+	for (int i = 0; ok && i < texture->num_pinned_slots; i++) {
+		int page = texture->mips[first_pinned_level + i].first_page;
+		ok = fseek(file, texture->data_offset + page * (long)VIRTUAL_PAGE_BYTES, SEEK_SET) == 0 &&
+			fread(texture->slot_texels + i * VIRTUAL_PAGE_TEXELS, VIRTUAL_PAGE_BYTES, 1, file) == 1;
+		texture->pages[page].slot = i;
+		SDL_AtomicSet(&texture->pages[page].state, page_resident);
+		texture->slot_page[i] = page;
+	}
+
+	if (!ok) {
+		virtual_texture_free(texture);
+		return NULL;
+	}
+
+	open_textures[num_open_textures++] = texture;
+	return texture;
+}
+
+void virtual_texture_free(virtual_texture_t* texture) {
+	// Take the texture off the loader, waiting out a read of one of its pages
+	if (loader_mutex != NULL) {
+		SDL_LockMutex(loader_mutex);
+		int count = 0;
+		for (int i = 0; i < loader_queue_count; i++) {
+			if (loader_queue[i].texture != texture)
+				loader_queue[count++] = loader_queue[i];
+		}
+		loader_queue_count = count;
+		while (loader_current == texture)
+			SDL_CondWait(loader_idle, loader_mutex);
+		count = 0;
+		for (int i = 0; i < loader_done_count; i++) {
+			if (loader_done[i].texture != texture)
+				loader_done[count++] = loader_done[i];
+			else
+				free(loader_done[i].texels);
+		}
+		loader_done_count = count;
+		SDL_UnlockMutex(loader_mutex);
+	}
+
+	for (int i = 0; i < num_open_textures; i++) {
+		if (open_textures[i] == texture) {
+			open_textures[i] = open_textures[--num_open_textures];
+			break;
+		}
+	}
+
+	fclose(texture->file);
+	free(texture->pages);
+	free(texture->slot_texels);
+	free(texture->slot_page);
+	free(texture->slot_last_used);
+	free(texture);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Point sample the level closest to lod, or the first coarser level that is
+// resident. Missing pages on the way are recorded for the loader.
+///////////////////////////////////////////////////////////////////////////////
+uint32_t virtual_texture_sample(virtual_texture_t* texture, float u, float v, float lod) {
+	int level = (int)(lod + 0.5f);
+	if (level >= texture->num_mips)
+		level = texture->num_mips - 1;
+
+	for (;; level++) {
+		const virtual_mip_t* mip = &texture->mips[level];
+		int x = (int)(u * mip->width) % mip->width;
+		int y = (int)(v * mip->height) % mip->height;
+		if (x < 0) x += mip->width;
+		if (y < 0) y += mip->height;
+
+		int page = mip->first_page + (y / VIRTUAL_PAGE_SIZE) * mip->pages_x + x / VIRTUAL_PAGE_SIZE;
+		virtual_page_t* entry = &texture->pages[page];
+		if (entry->slot >= 0) {
+			// Every thread stores the same frame, so only the first one to get here has to
+			SDL_atomic_t* last_used = &texture->slot_last_used[entry->slot];
+			if (SDL_AtomicGet(last_used) != (int)texture->frame)
+				SDL_AtomicSet(last_used, (int)texture->frame);
+			return texture->slot_texels[
+				entry->slot * VIRTUAL_PAGE_TEXELS +
+				(y % VIRTUAL_PAGE_SIZE) * VIRTUAL_PAGE_SIZE +
+				x % VIRTUAL_PAGE_SIZE
+			];
+		}
+		if (SDL_AtomicGet(&entry->state) == page_missing) {
+			SDL_AtomicLock(&texture->request_lock);
+			if (SDL_AtomicGet(&entry->state) == page_missing && texture->num_requests < VIRTUAL_MAX_REQUESTS) {
+				SDL_AtomicSet(&entry->state, page_queued);
+				texture->requests[texture->num_requests++] = page;
+			}
+			SDL_AtomicUnlock(&texture->request_lock);
+		}
+	}
+}
+
+// Least recently used slot outside the pinned ones, free slots first
+static int virtual_texture_victim_slot(const virtual_texture_t* texture) {
+	int victim = texture->num_pinned_slots;
+	for (int i = texture->num_pinned_slots; i < texture->num_slots; i++) {
+		if (texture->slot_page[i] < 0)
+			return i;
+		if ((unsigned)SDL_AtomicGet(&texture->slot_last_used[i]) < (unsigned)SDL_AtomicGet(&texture->slot_last_used[victim]))
+			victim = i;
+	}
+	return victim;
+}
+
+static void virtual_texture_install(virtual_texture_t* texture, int page, const uint32_t* texels) {
+	int slot = virtual_texture_victim_slot(texture);
+	int evicted = texture->slot_page[slot];
+	if (evicted >= 0) {
+		texture->pages[evicted].slot = -1;
+		SDL_AtomicSet(&texture->pages[evicted].state, page_missing);
+	}
+	memcpy(texture->slot_texels + slot * VIRTUAL_PAGE_TEXELS, texels, VIRTUAL_PAGE_BYTES);
+	texture->slot_page[slot] = page;
+	SDL_AtomicSet(&texture->slot_last_used[slot], (int)texture->frame);
+	texture->pages[page].slot = slot;
+	SDL_AtomicSet(&texture->pages[page].state, page_resident);
+}
+
+// Coarser levels first, they replace the most of the fallback for the least data
+static int compare_page_levels(const void* a, const void* b) {
+	return *(const int*)b - *(const int*)a;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Called by the application between frames, while no context is drawing:
+// move the pages the loader has read into the caches, then hand it the pages
+// the last frames were missing
+///////////////////////////////////////////////////////////////////////////////
+void virtual_textures_end_frame(void) {
+	if (loader_thread == NULL)
+		return;
+
+	page_load_t done[LOADER_MAX_IN_FLIGHT];
+	SDL_LockMutex(loader_mutex);
+	int num_done = loader_done_count;
+	memcpy(done, loader_done, sizeof(page_load_t) * num_done);
+	loader_done_count = 0;
+	SDL_UnlockMutex(loader_mutex);
+
+	for (int i = 0; i < num_done; i++) {
+		if (done[i].texels != NULL)
+			virtual_texture_install(done[i].texture, done[i].page, done[i].texels);
+		else
+			SDL_AtomicSet(&done[i].texture->pages[done[i].page].state, page_missing);
+		free(done[i].texels);
+	}
+
+	SDL_LockMutex(loader_mutex);
+	int in_flight = loader_queue_count + loader_done_count + (loader_current != NULL);
+	for (int t = 0; t < num_open_textures; t++) {
+		virtual_texture_t* texture = open_textures[t];
+
+		// Page numbers grow with the level, so sorting them puts coarse levels first
+		qsort(texture->requests, texture->num_requests, sizeof(int), compare_page_levels);
+		for (int i = 0; i < texture->num_requests; i++) {
+			if (in_flight < LOADER_MAX_IN_FLIGHT) {
+				page_load_t load = { texture, texture->requests[i], NULL };
+				loader_queue[loader_queue_count++] = load;
+				in_flight++;
+			} else {
+				// No room this frame, the page is asked for again if still needed
+				SDL_AtomicSet(&texture->pages[texture->requests[i]].state, page_missing);
+			}
+		}
+		texture->num_requests = 0;
+		texture->frame++;
+	}
+	if (loader_queue_count > 0)
+		SDL_CondSignal(loader_wake);
+	SDL_UnlockMutex(loader_mutex);
+}
@@ -0,0 +1,57 @@
+#ifndef VIRTUAL_TEXTURE_H
+#define VIRTUAL_TEXTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <SDL.h>
+#include "texture.h"
+#include "upng.h"
+
+#define VIRTUAL_PAGE_SIZE 128 // texels on each side of a page, a power of two
+#define VIRTUAL_MAX_REQUESTS 256 // pages a texture can request in one frame
+
+typedef struct {
+    int width;
+    int height;
+    int pages_x;
+    int pages_y;
+    int first_page; // index of the level's first page in the page file and the page table
+} virtual_mip_t;
+
+typedef struct {
+    int slot;           // cache slot holding the page, -1 when it is not resident
+    SDL_atomic_t state; // page_missing, page_queued or page_resident, drawing threads may queue it at once
+} virtual_page_t;
+
+typedef struct virtual_texture_t {
+    FILE* file;           // page file, only read by the loader thread once open
+    long data_offset;     // file offset of the first page
+    int num_mips;
+    virtual_mip_t mips[MAX_MIP_LEVELS];
+    int num_pages;
+    virtual_page_t* pages; // page table of every level
+
+    int num_slots;
+    int num_pinned_slots;     // the first slots hold the coarsest levels for good
+    uint32_t* slot_texels;    // the physical page cache, num_slots pages of texels
+    int* slot_page;           // page held by each slot, -1 when the slot is free
+    SDL_atomic_t* slot_last_used; // frame the slot was last sampled in, by any drawing thread
+
+    int requests[VIRTUAL_MAX_REQUESTS]; // pages found missing while drawing this frame
+    int num_requests;
+    SDL_SpinLock request_lock; // threads drawing bands of the frame may miss pages at once
+    unsigned frame;
+} virtual_texture_t;
+
+extern int virtual_texture_threshold;   // textures wider or taller than this are paged
+extern int virtual_texture_cache_pages; // cache slots of every virtual texture, besides the pinned ones
+
+bool virtual_texture_build(const char* pages_path, uint64_t source_hash, upng_t* png);
+virtual_texture_t* virtual_texture_open(const char* pages_path, uint64_t source_hash);
+void virtual_texture_free(virtual_texture_t* texture);
+uint32_t virtual_texture_sample(virtual_texture_t* texture, float u, float v, float lod);
+void virtual_textures_end_frame(void);
+void virtual_texture_shutdown(void);
+
+#endif